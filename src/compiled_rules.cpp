@@ -0,0 +1,42 @@
+#include "compiled_rules.h"
+#include <map>
+
+namespace sen {
+namespace {
+// Filled before main() runs and only read afterwards, so no locking is needed.
+std::map<std::string, compiled_rule>& registry() {
+    static std::map<std::string, compiled_rule> rules;
+    return rules;
+}
+} // namespace
+
+std::string rule_signature(const std::string& context, const actions::rule_t& rule) {
+    auto attributes = [](std::string& out, const std::vector<actions::attribute_t>& attrs) {
+        for (const auto& attr : attrs) {
+            out += '\x1e' + attr.key + '\x1d' + attr.value;
+        }
+    };
+    std::string signature = context + '\x1f' + rule.name;
+    for (const auto& condition : rule.conditions) {
+        if (const auto* rel = std::get_if<actions::relation_t>(&condition.value)) {
+            signature += "\x1fR" + rel->var1 + '\x1e' + rel->relation_name + '\x1e' + rel->var2;
+            attributes(signature, rel->attributes);
+        } else if (const auto* pred = std::get_if<actions::predicate_t>(&condition.value)) {
+            signature += "\x1fP" + pred->var + '\x1e' + pred->key + '\x1e' + pred->value;
+        }
+    }
+    const auto& conclusion = rule.conclusion;
+    signature += "\x1f=" + conclusion.var1 + '\x1e' + conclusion.relation_name + '\x1e' + conclusion.var2;
+    attributes(signature, conclusion.attributes);
+    return signature;
+}
+
+compiled_rule_registrar::compiled_rule_registrar(const char* signature, compiled_rule rule) {
+    registry()[signature] = rule;
+}
+
+compiled_rule find_compiled_rule(const std::string& signature) {
+    auto it = registry().find(signature);
+    return it == registry().end() ? nullptr : it->second;
+}
+} // namespace sen
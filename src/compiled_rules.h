@@ -0,0 +1,36 @@
+#pragma once
+
+#include "fact_store.h"
+#include <functional>
+#include <string>
+
+namespace sen {
+// A rule specialized ahead of time by sen-rulegen. It computes the same relations as the
+// interpreted matcher, passing each of them to emit; returning false from emit or interrupted
+// stops it, in which case it returns false.
+using compiled_rule = bool (*)(const fact_view& view, const std::function<bool()>& interrupted,
+                               const std::function<bool(const actions::relation_t&)>& emit);
+
+// Canonical text of a rule after alias resolution, compiled rules are looked up by it.
+std::string rule_signature(const std::string& context, const actions::rule_t& rule);
+
+// Generated sources register their rules during static initialization.
+struct compiled_rule_registrar {
+    compiled_rule_registrar(const char* signature, compiled_rule rule);
+};
+
+// Returns nullptr if no compiled rule with this signature is linked in.
+compiled_rule find_compiled_rule(const std::string& signature);
+
+// Helpers used by the generated code.
+inline bool has_attribute(const fact_t& fact, const char* key, const char* value) {
+    return std::any_of(fact.attributes.begin(), fact.attributes.end(),
+                       [&](const auto& attr) { return attr.key == key && attr.value == value; });
+}
+
+// Binary search in the snapshot's sorted predicate segments.
+inline bool has_predicate(const fact_snapshot& snapshot, const std::string& entity, const std::string& key,
+                          const std::string& value) {
+    return snapshot.has_predicate(entity, key, value);
+}
+} // namespace sen
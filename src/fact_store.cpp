@@ -0,0 +1,308 @@
+#include "fact_store.h"
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sen {
+namespace {
+// Spill file names are unique within the process, even across stores created at the address of
+// a destroyed one whose snapshots still map its files.
+std::atomic<uint64_t> next_segment_id{0};
+} // namespace
+
+fact_store::fact_store(fact_store_options options)
+    : options(std::move(options)), current(std::make_shared<const fact_snapshot>()) {
+    if (!this->options.directory.empty()) {
+        struct stat info;
+        if (::stat(this->options.directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) ||
+            ::access(this->options.directory.c_str(), W_OK | X_OK) != 0) {
+            throw std::runtime_error("Segment directory " + this->options.directory + " is not a writable directory");
+        }
+        compactor = std::thread(&fact_store::compact_loop, this);
+    }
+}
+
+fact_store::~fact_store() {
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        stopping = true;
+    }
+    compaction_signal.notify_all();
+    capacity_signal.notify_all();
+    if (compactor.joinable()) compactor.join();
+}
+
+std::shared_ptr<const fact_snapshot> fact_store::snapshot() const {
+    return std::atomic_load(&current);
+}
+
+uint64_t fact_store::add_fact(fact_t fact, const std::string& mime_type) {
+    std::vector<fact_t> facts;
+    facts.push_back(std::move(fact));
+    return add_facts(std::move(facts), mime_type);
+}
+
+uint64_t fact_store::add_facts(std::vector<fact_t> facts, const std::string& mime_type) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    std::set<partition_key> keys;
+    for (const auto& fact : facts) keys.insert(type_of(fact, mime_type));
+    wait_for_capacity(lock, keys);
+    return append(std::move(facts), mime_type);
+}
+
+uint64_t fact_store::add_new_facts(std::vector<fact_t> facts) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    wait_for_capacity(lock, {std::string()});
+    auto latest = std::atomic_load(&current);
+    facts.erase(std::remove_if(facts.begin(), facts.end(), [&](const fact_t& fact) { return latest->contains(fact); }),
+                facts.end());
+    if (facts.empty()) return latest->version;
+    return append(std::move(facts), "", false);
+}
+
+const fact_partition* fact_store::find_partition(const fact_snapshot& snapshot, const partition_key& key) {
+    if (!key) return &snapshot.predicates;
+    auto it = snapshot.partitions.find(*key);
+    return it == snapshot.partitions.end() ? nullptr : &it->second;
+}
+
+fact_partition& fact_store::partition_of(fact_snapshot& snapshot, const partition_key& key) {
+    return key ? snapshot.partitions[*key] : snapshot.predicates;
+}
+
+// Expects writer_mutex to be held.
+std::string fact_store::type_of(const fact_t& fact, const std::string& mime_type, bool by_entity) const {
+    if (!mime_type.empty() || !by_entity) return mime_type;
+    auto it = entity_types.find(fact.var1);
+    return it != entity_types.end() ? it->second : "";
+}
+
+std::string fact_store::describe(const partition_key& key) {
+    return key ? "partition '" + *key + "'" : std::string("predicates");
+}
+
+// Whether a flush of the partition is running and it holds max_buffered_facts in memory.
+// Without a running flush the write buffer is sealed once full, so there is nothing to wait for.
+bool fact_store::at_capacity(const fact_snapshot& snapshot, const partition_key& key) const {
+    const auto* partition = find_partition(snapshot, key);
+    if (!partition || partition->sealed.empty()) return false;
+    size_t in_memory = partition->buffered();
+    for (const auto& segment : partition->sealed) in_memory += segment->size();
+    return in_memory >= options.max_buffered_facts;
+}
+
+// Blocks while one of the partitions is at capacity. Throws if the flush of one of them gave up
+// and queues it again, so the next write waits for a new round of attempts.
+void fact_store::wait_for_capacity(std::unique_lock<std::mutex>& lock, const std::set<partition_key>& keys) {
+    if (options.directory.empty()) return;
+    const partition_key* failed = nullptr;
+    capacity_signal.wait(lock, [&] {
+        if (stopping) return true;
+        auto latest = std::atomic_load(&current);
+        for (const auto& key : keys) {
+            if (!at_capacity(*latest, key)) continue;
+            if (compaction_failures.count(key)) {
+                failed = &key;
+                return true;
+            }
+            return false;
+        }
+        return true;
+    });
+    if (!failed) return;
+    const std::string error = compaction_failures[*failed];
+    compaction_failures.erase(*failed);
+    compaction_queue.insert(*failed);
+    compaction_signal.notify_one();
+    throw std::runtime_error("Flush of " + describe(*failed) + " failed: " + error);
+}
+
+// Adds facts to a partition of the next version and seals a full write buffer for the
+// compactor, one flush per partition at a time. Returns whether the compactor has work.
+// Expects writer_mutex to be held.
+bool fact_store::buffer(fact_snapshot& next, const partition_key& key, std::vector<fact_t> facts) {
+    auto& partition = partition_of(next, key);
+    partition.fact_count += facts.size();
+    append_fact_segment(partition.segments, std::move(facts));
+    if (options.directory.empty() || !partition.sealed.empty() || partition.buffered() < options.buffer_facts) {
+        return false;
+    }
+    partition.sealed = std::move(partition.segments);
+    partition.segments.clear();
+    compaction_queue.insert(key);
+    return true;
+}
+
+// Expects writer_mutex to be held.
+uint64_t fact_store::append(std::vector<fact_t> facts, const std::string& mime_type, bool by_entity) {
+    auto next = std::make_shared<fact_snapshot>(*std::atomic_load(&current));
+    next->fact_count += facts.size();
+    std::map<std::string, std::vector<fact_t>> by_type;
+    for (auto& fact : facts) {
+        by_type[type_of(fact, mime_type, by_entity)].push_back(std::move(fact));
+    }
+    bool compact = false;
+    for (auto& [type, typed_facts] : by_type) {
+        compact |= buffer(*next, type, std::move(typed_facts));
+    }
+    publish(next);
+    if (compact) compaction_signal.notify_one();
+    return next->version;
+}
+
+uint64_t fact_store::add_predicate(predicate_t predicate) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    wait_for_capacity(lock, {std::nullopt});
+    auto next = std::make_shared<fact_snapshot>(*std::atomic_load(&current));
+    std::vector<fact_t> facts;
+    facts.push_back(fact_snapshot::as_fact(std::move(predicate)));
+    bool compact = buffer(*next, std::nullopt, std::move(facts));
+    publish(next);
+    if (compact) compaction_signal.notify_one();
+    return next->version;
+}
+
+void fact_store::set_entity_type(const std::string& entity, const std::string& mime_type) {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    entity_types[entity] = mime_type;
+}
+
+// Appends a new immutable segment and merges trailing segments of similar size, like a binary
+// counter, so the segment count stays logarithmic while each fact is copied O(log n) times.
+// Merging always produces a fresh segment, older snapshots keep the ones they reference alive.
+void fact_store::append_fact_segment(std::vector<std::shared_ptr<const memory_segment>>& segments,
+                                     std::vector<fact_t> facts) {
+    std::stable_sort(facts.begin(), facts.end(), fact_less);
+    auto tail = std::make_shared<memory_segment>(std::move(facts));
+    while (!segments.empty() && segments.back()->size() <= tail->size()) {
+        auto merged = std::make_shared<memory_segment>();
+        merged->reserve(segments.back()->size() + tail->size());
+        std::merge(segments.back()->begin(), segments.back()->end(), std::make_move_iterator(tail->begin()),
+                   std::make_move_iterator(tail->end()), std::back_inserter(*merged), fact_less);
+        segments.pop_back();
+        tail = std::move(merged);
+    }
+    segments.push_back(std::move(tail));
+}
+
+void fact_store::publish(std::shared_ptr<fact_snapshot> next) {
+    next->version++;
+    std::atomic_store(&current, std::shared_ptr<const fact_snapshot>(std::move(next)));
+}
+
+void fact_store::compact_loop() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    std::map<partition_key, int> failed_attempts;
+    while (true) {
+        compaction_signal.wait(lock, [this] { return stopping || !compaction_queue.empty(); });
+        // sealed segments still queued at shutdown simply stay in memory
+        if (stopping) return;
+        partition_key key = *compaction_queue.begin();
+        compaction_queue.erase(compaction_queue.begin());
+        lock.unlock();
+        try {
+            compact(key);
+        } catch (const std::exception& e) {
+            // the sealed segments stay readable in memory until a retry succeeds
+            lock.lock();
+            if (++failed_attempts[key] >= compaction_attempts) {
+                std::cerr << "Compaction of " << describe(key) << " failed: " << e.what() << ", giving up\n";
+                failed_attempts.erase(key);
+                compaction_failures[key] = e.what();
+                capacity_signal.notify_all();
+                continue;
+            }
+            std::cerr << "Compaction of " << describe(key) << " failed: " << e.what() << ", retrying\n";
+            compaction_signal.wait_for(lock, compaction_retry_delay, [this] { return stopping; });
+            compaction_queue.insert(key);
+            continue;
+        }
+        lock.lock();
+        failed_attempts.erase(key);
+    }
+}
+
+// Writes the sealed segments of a partition to a new disk segment, merging in trailing disk
+// segments that are not larger than what is written so far, up to max_merge_facts in total.
+// Larger segments stay as they are, so a late flush does not rewrite the whole partition.
+// Only the compactor removes sealed or disk segments, so the ones captured here are still in
+// place when publishing.
+void fact_store::compact(const partition_key& key) {
+    auto snap = snapshot();
+    const auto* found = find_partition(*snap, key);
+    if (!found || found->sealed.empty()) return;
+    const auto& partition = *found;
+
+    size_t merged_size = 0;
+    for (const auto& segment : partition.sealed) merged_size += segment->size();
+    size_t first_merged = partition.disk_segments.size();
+    while (first_merged > 0 && partition.disk_segments[first_merged - 1]->size() <= merged_size &&
+           merged_size + partition.disk_segments[first_merged - 1]->size() <= options.max_merge_facts) {
+        merged_size += partition.disk_segments[--first_merged]->size();
+    }
+    std::vector<std::shared_ptr<const mapped_segment>> merging(partition.disk_segments.begin() + first_merged,
+                                                               partition.disk_segments.end());
+
+    std::set<std::string> relations;
+    for (const auto& segment : merging) {
+        for (const auto& entry : segment->relations()) relations.insert(entry.name);
+    }
+    for (const auto& segment : partition.sealed) {
+        for (const auto& fact : *segment) relations.insert(fact.relation_name);
+    }
+
+    segment_writer writer(options.directory + "/facts-" + std::to_string(::getpid()) + "-" +
+                          std::to_string(next_segment_id++) + ".seg");
+    for (const auto& relation : relations) {
+        writer.begin_relation(relation);
+        // k-way merge of the relation's facts, oldest source first among equal facts
+        std::vector<mapped_segment::cursor> cursors;
+        for (const auto& segment : merging) cursors.emplace_back(*segment, relation);
+        std::vector<std::pair<memory_segment::const_iterator, memory_segment::const_iterator>> ranges;
+        for (const auto& segment : partition.sealed) {
+            ranges.push_back(relation_range(*segment, relation));
+        }
+        while (true) {
+            const fact_t* next = nullptr;
+            size_t source = 0;
+            for (size_t i = 0; i < cursors.size(); ++i) {
+                if (cursors[i].valid() && (!next || fact_less(cursors[i].fact(), *next))) {
+                    next = &cursors[i].fact();
+                    source = i;
+                }
+            }
+            for (size_t i = 0; i < ranges.size(); ++i) {
+                if (ranges[i].first != ranges[i].second && (!next || fact_less(*ranges[i].first, *next))) {
+                    next = &*ranges[i].first;
+                    source = cursors.size() + i;
+                }
+            }
+            if (!next) break;
+            writer.add(*next);
+            if (source < cursors.size()) {
+                cursors[source].next();
+            } else {
+                ++ranges[source - cursors.size()].first;
+            }
+        }
+    }
+    auto written = writer.finish();
+
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    auto next = std::make_shared<fact_snapshot>(*std::atomic_load(&current));
+    auto& target = partition_of(*next, key);
+    target.sealed.clear();
+    target.disk_segments.resize(first_merged);
+    target.disk_segments.push_back(std::move(written));
+    // the write buffer may have filled up again while this flush was running
+    if (target.buffered() >= options.buffer_facts) {
+        target.sealed = std::move(target.segments);
+        target.segments.clear();
+        compaction_queue.insert(key);
+    }
+    publish(next);
+    capacity_signal.notify_all();
+}
+} // namespace sen
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "sen_grammar.h"
+#include "mapped_segment.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace sen {
+using fact_t = actions::relation_t;
+using predicate_t = actions::predicate_t;
+
+// In-memory segments are sorted by fact_less like disk segments, equal facts in insertion order.
+using memory_segment = std::vector<fact_t>;
+
+inline std::pair<memory_segment::const_iterator, memory_segment::const_iterator>
+relation_range(const memory_segment& segment, const std::string& relation) {
+    auto first = std::lower_bound(segment.begin(), segment.end(), relation,
+                                  [](const fact_t& fact, const std::string& name) { return fact.relation_name < name; });
+    auto last = std::upper_bound(first, segment.end(), relation,
+                                 [](const std::string& name, const fact_t& fact) { return name < fact.relation_name; });
+    return {first, last};
+}
+
+template<typename F>
+bool for_each_fact_in(const memory_segment& segment, const std::string& relation, F&& f) {
+    auto [first, last] = relation_range(segment, relation);
+    for (auto it = first; it != last; ++it) {
+        if (!f(*it)) return false;
+    }
+    return true;
+}
+
+// Facts of the relation whose first entity is var1.
+template<typename F>
+bool for_each_fact_in(const memory_segment& segment, const std::string& relation, const std::string& var1, F&& f) {
+    auto [first, last] = relation_range(segment, relation);
+    first = std::lower_bound(first, last, var1, [](const fact_t& fact, const std::string& v) { return fact.var1 < v; });
+    for (auto it = first; it != last && it->var1 == var1; ++it) {
+        if (!f(*it)) return false;
+    }
+    return true;
+}
+
+// Visits share `part` of `parts` equally sized, disjoint shares of the relation's facts.
+template<typename F>
+bool for_each_fact_in(const memory_segment& segment, const std::string& relation, size_t part, size_t parts, F&& f) {
+    auto [first, last] = relation_range(segment, relation);
+    const size_t count = last - first;
+    for (auto it = first + count * part / parts; it != first + count * (part + 1) / parts; ++it) {
+        if (!f(*it)) return false;
+    }
+    return true;
+}
+
+inline bool segment_contains(const memory_segment& segment, const fact_t& fact) {
+    for (auto it = std::lower_bound(segment.begin(), segment.end(), fact, fact_less);
+         it != segment.end() && !fact_less(fact, *it); ++it) {
+        if (same_attributes(it->attributes, fact.attributes)) return true;
+    }
+    return false;
+}
+
+// Facts of one MIME type. Oldest first, they are spread over memory-mapped disk segments,
+// memory segments currently being written to disk, and the in-memory write buffer.
+struct fact_partition {
+    size_t fact_count = 0;
+    std::vector<std::shared_ptr<const mapped_segment>> disk_segments;
+    std::vector<std::shared_ptr<const memory_segment>> sealed;
+    std::vector<std::shared_ptr<const memory_segment>> segments;
+
+    size_t buffered() const {
+        size_t count = 0;
+        for (const auto& segment : segments) count += segment->size();
+        return count;
+    }
+
+    template<typename F>
+    bool for_each_fact(F&& f) const {
+        for (const auto& segment : disk_segments) {
+            if (!segment->for_each_fact(f)) return false;
+        }
+        for (const auto* list : {&sealed, &segments}) {
+            for (const auto& segment : *list) {
+                for (const auto& fact : *segment) {
+                    if (!f(fact)) return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, F&& f) const {
+        for (const auto& segment : disk_segments) {
+            if (!segment->for_each_fact(relation, f)) return false;
+        }
+        for (const auto* list : {&sealed, &segments}) {
+            for (const auto& segment : *list) {
+                if (!for_each_fact_in(*segment, relation, f)) return false;
+            }
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, const std::string& var1, F&& f) const {
+        for (const auto& segment : disk_segments) {
+            if (!segment->for_each_fact(relation, var1, f)) return false;
+        }
+        for (const auto* list : {&sealed, &segments}) {
+            for (const auto& segment : *list) {
+                if (!for_each_fact_in(*segment, relation, var1, f)) return false;
+            }
+        }
+        return true;
+    }
+
+    // Visits one of `parts` disjoint shares of the relation's facts, every segment is split.
+    template<typename F>
+    bool for_each_fact(const std::string& relation, size_t part, size_t parts, F&& f) const {
+        for (const auto& segment : disk_segments) {
+            if (!segment->for_each_fact(relation, part, parts, f)) return false;
+        }
+        for (const auto* list : {&sealed, &segments}) {
+            for (const auto& segment : *list) {
+                if (!for_each_fact_in(*segment, relation, part, parts, f)) return false;
+            }
+        }
+        return true;
+    }
+
+    bool contains(const fact_t& fact) const {
+        for (const auto& segment : disk_segments) {
+            if (segment->contains(fact)) return true;
+        }
+        for (const auto* list : {&sealed, &segments}) {
+            for (const auto& segment : *list) {
+                if (segment_contains(*segment, fact)) return true;
+            }
+        }
+        return false;
+    }
+};
+
+// An immutable, versioned view of the fact store.
+// Segments are shared between snapshots and never modified once published, so a reader can keep
+// using its snapshot for as long as it likes while the writer publishes newer versions.
+// Facts are partitioned by MIME type, untyped facts live in the partition keyed "".
+// Predicates are kept as facts of a relation named after their key that relate the entity to
+// the value, so they are sorted by key, entity and value and spill to disk like facts.
+// Facts read from disk segments are decoded on the fly and only valid inside the callback.
+struct fact_snapshot {
+    uint64_t version = 0;
+    size_t fact_count = 0;
+    std::map<std::string, fact_partition> partitions;
+    fact_partition predicates;
+
+    // Visit facts partition by partition, the callback returns false to stop early.
+    template<typename F>
+    bool for_each_fact(F&& f) const {
+        for (const auto& [type, partition] : partitions) {
+            if (!partition.for_each_fact(f)) return false;
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, F&& f) const {
+        for (const auto& [type, partition] : partitions) {
+            if (!partition.for_each_fact(relation, f)) return false;
+        }
+        return true;
+    }
+
+    // Facts of the relation whose first entity is var1, looked up in every segment.
+    template<typename F>
+    bool for_each_fact(const std::string& relation, const std::string& var1, F&& f) const {
+        for (const auto& [type, partition] : partitions) {
+            if (!partition.for_each_fact(relation, var1, f)) return false;
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, size_t part, size_t parts, F&& f) const {
+        for (const auto& [type, partition] : partitions) {
+            if (!partition.for_each_fact(relation, part, parts, f)) return false;
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool for_each_predicate(F&& f) const {
+        return predicates.for_each_fact([&](const fact_t& fact) { return f(as_predicate(fact)); });
+    }
+
+    template<typename F>
+    bool for_each_predicate(const std::string& key, F&& f) const {
+        return predicates.for_each_fact(key, [&](const fact_t& fact) { return f(as_predicate(fact)); });
+    }
+
+    // Binary search per predicate segment.
+    bool has_predicate(const std::string& entity, const std::string& key, const std::string& value) const {
+        return predicates.contains({entity, key, value, {}});
+    }
+
+    static fact_t as_fact(predicate_t predicate) {
+        return {std::move(predicate.var), std::move(predicate.key), std::move(predicate.value), {}};
+    }
+    static predicate_t as_predicate(const fact_t& fact) { return {fact.var1, fact.relation_name, fact.var2}; }
+
+    // Looks the fact up in every partition with a binary search per segment.
+    bool contains(const fact_t& fact) const {
+        return std::any_of(partitions.begin(), partitions.end(),
+                           [&](const auto& entry) { return entry.second.contains(fact); });
+    }
+
+    bool spilled() const {
+        return std::any_of(partitions.begin(), partitions.end(),
+                           [](const auto& entry) { return !entry.second.disk_segments.empty(); });
+    }
+};
+
+// A consistent snapshot plus a snapshot of the relations derived so far by a running inference.
+// If scope is set, only the listed partitions of the snapshot are scanned; derived relations are
+// always visible.
+struct fact_view {
+    const fact_snapshot& snapshot;
+    const fact_snapshot& derived;
+    const std::vector<const fact_partition*>* scope = nullptr;
+
+    template<typename F>
+    bool for_each_fact(F&& f) const {
+        if (scope) {
+            for (const auto* partition : *scope) {
+                if (!partition->for_each_fact(f)) return false;
+            }
+        } else if (!snapshot.for_each_fact(f)) {
+            return false;
+        }
+        return derived.for_each_fact(f);
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, F&& f) const {
+        if (scope) {
+            for (const auto* partition : *scope) {
+                if (!partition->for_each_fact(relation, f)) return false;
+            }
+        } else if (!snapshot.for_each_fact(relation, f)) {
+            return false;
+        }
+        return derived.for_each_fact(relation, f);
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, const std::string& var1, F&& f) const {
+        if (scope) {
+            for (const auto* partition : *scope) {
+                if (!partition->for_each_fact(relation, var1, f)) return false;
+            }
+        } else if (!snapshot.for_each_fact(relation, var1, f)) {
+            return false;
+        }
+        return derived.for_each_fact(relation, var1, f);
+    }
+
+    // Shares of all visible facts of a relation, scanning every share once visits each fact once.
+    template<typename F>
+    bool for_each_fact(const std::string& relation, size_t part, size_t parts, F&& f) const {
+        if (scope) {
+            for (const auto* partition : *scope) {
+                if (!partition->for_each_fact(relation, part, parts, f)) return false;
+            }
+        } else if (!snapshot.for_each_fact(relation, part, parts, f)) {
+            return false;
+        }
+        return derived.for_each_fact(relation, part, parts, f);
+    }
+
+    bool spilled() const { return snapshot.spilled() || derived.spilled(); }
+};
+
+struct fact_store_options {
+    // Directory for memory-mapped segment files, empty keeps all facts and predicates in memory.
+    std::string directory;
+    // Facts a partition buffers in memory before they are written to disk.
+    size_t buffer_facts = 1 << 20;
+    // Facts a partition may hold in memory while its previous buffer is being written, writers
+    // adding to it wait above this.
+    size_t max_buffered_facts = 1 << 22;
+    // Disk segments are merged up to this size, which bounds the facts a single flush rewrites.
+    size_t max_merge_facts = 1 << 26;
+};
+
+// Append-only, multi-version fact store with a single writer.
+// Readers take the current snapshot with std::atomic_load and never wait for writer_mutex, so
+// ingest and compaction do not block them. This is not lock-free: libstdc++ guards shared_ptr
+// atomics with a small global mutex pool, held only while the pointer is copied. Writers are
+// serialized among themselves and publish a new version for every append.
+// With a directory set, full write buffers are handed to a background thread that writes
+// them to sorted segment files, merging similar-sized ones, and publishes a new version when done.
+// Predicates are buffered, flushed and merged the same way in a partition of their own.
+// Writers to a partition whose flush has not caught up with max_buffered_facts block until it
+// finishes. A failed flush keeps the sealed facts in memory and is retried after a delay, up to
+// compaction_attempts times. After that, writers that would block on the partition throw
+// instead, and each such write queues another round of attempts.
+class fact_store {
+public:
+    // Throws std::runtime_error if options.directory is set but not a writable directory.
+    explicit fact_store(fact_store_options options = {});
+    ~fact_store();
+    fact_store(const fact_store&) = delete;
+    fact_store& operator=(const fact_store&) = delete;
+
+    std::shared_ptr<const fact_snapshot> snapshot() const;
+
+    // Facts without an explicit MIME type take the type registered for their first entity.
+    // The writes throw std::runtime_error if they would wait for a flush that gave up, see above.
+    uint64_t add_fact(fact_t fact, const std::string& mime_type = "");
+    uint64_t add_facts(std::vector<fact_t> facts, const std::string& mime_type = "");
+    // Like add_facts, but skips facts the current version already holds. The check and the
+    // append are atomic, so concurrent inferences never publish the same relation twice.
+    // The facts are stored untyped whatever their entities' types, so relations derived by
+    // rules stay visible to every context, as they are during the inference deriving them.
+    uint64_t add_new_facts(std::vector<fact_t> facts);
+    uint64_t add_predicate(predicate_t predicate);
+    // Only affects facts ingested afterwards.
+    void set_entity_type(const std::string& entity, const std::string& mime_type);
+
+private:
+    const fact_store_options options;
+    std::shared_ptr<const fact_snapshot> current;   // only accessed through std::atomic_load/store, see above
+    std::mutex writer_mutex;
+    std::unordered_map<std::string, std::string> entity_types;   // guarded by writer_mutex
+
+    std::condition_variable compaction_signal;
+    std::condition_variable capacity_signal;   // a flush finished
+    // Partitions are named by MIME type, std::nullopt names the predicates.
+    using partition_key = std::optional<std::string>;
+    std::set<partition_key> compaction_queue;   // partitions with sealed segments, guarded by writer_mutex
+    // Last error of partitions whose flush failed compaction_attempts times in a row, guarded by writer_mutex.
+    std::map<partition_key, std::string> compaction_failures;
+    bool stopping = false;
+    std::thread compactor;
+    static constexpr std::chrono::seconds compaction_retry_delay{1};
+    static constexpr int compaction_attempts = 3;
+
+    static void append_fact_segment(std::vector<std::shared_ptr<const memory_segment>>& segments,
+                                    std::vector<fact_t> facts);
+    static const fact_partition* find_partition(const fact_snapshot& snapshot, const partition_key& key);
+    static std::string describe(const partition_key& key);
+    bool at_capacity(const fact_snapshot& snapshot, const partition_key& key) const;
+    static fact_partition& partition_of(fact_snapshot& snapshot, const partition_key& key);
+    std::string type_of(const fact_t& fact, const std::string& mime_type, bool by_entity = true) const;
+    void wait_for_capacity(std::unique_lock<std::mutex>& lock, const std::set<partition_key>& keys);
+    bool buffer(fact_snapshot& next, const partition_key& key, std::vector<fact_t> facts);
+    uint64_t append(std::vector<fact_t> facts, const std::string& mime_type, bool by_entity = true);
+    void publish(std::shared_ptr<fact_snapshot> next);
+    void compact_loop();
+    void compact(const partition_key& key);
+};
+} // namespace sen
@@ -1,36 +1,50 @@
 #include "inference_engine.h"
+#include "partitioned_join.h"
 #include <iostream>
 #include <algorithm>
+#include <set>
+#include <tuple>
+#include <unordered_set>
 
 namespace sen {
-void InferenceEngine::parse(const std::string& dsl) {
-    tao::pegtl::string_input<> input(dsl, "rules");
-    try {
-        state.reset();
-        tao::pegtl::parse<grammar::grammar, actions::action>(input, state);
-        std::cout << "Parsed DSL successfully. Contexts: " << state.contexts.size() << "\n";
-        for (const auto& ctx : state.contexts) {
-            std::cout << "  Context: " << ctx.mime_type << ", Rules: " << ctx.rules.size() << "\n";
-            for (const auto& rule : ctx.rules) {
-                std::cout << "    Rule: " << rule.name << ", Conditions: " << rule.conditions.size()
-                          << ", Conclusion: " << rule.conclusion.relation_name << "\n";
-            }
-        }
-        for (const auto& [alias, rel] : state.aliases) {
-            std::cout << "  Alias: " << alias << " -> " << rel << "\n";
-        }
-    } catch (const tao::pegtl::parse_error& e) {
-        std::cerr << "Parse error: " << e.what() << "\n";
-        std::cerr << "At position: " << e.positions()[0].byte << "\n";
-        throw;
+std::string to_string(infer_status status) {
+    switch (status) {
+        case infer_status::complete: return "complete";
+        case infer_status::deadline_exceeded: return "deadline_exceeded";
+        case infer_status::budget_exhausted: return "budget_exhausted";
+        case infer_status::cancelled: return "cancelled";
+        case infer_status::stopped: return "stopped";
     }
+    return "unknown";
+}
+
+InferenceEngine::InferenceEngine() : InferenceEngine(std::make_shared<const rule_set>()) {}
+
+InferenceEngine::InferenceEngine(std::shared_ptr<const rule_set> rules, const fact_store_options& storage)
+    : current_rules(std::move(rules)), storage(storage), store(storage) {}
+
+void InferenceEngine::parse(const std::string& dsl) {
+    set_rules(rule_set::parse(dsl));
+}
+
+void InferenceEngine::set_rules(std::shared_ptr<const rule_set> rules) {
+    std::atomic_store(&current_rules, std::move(rules));
+}
+
+std::shared_ptr<const rule_set> InferenceEngine::rules() const {
+    return std::atomic_load(&current_rules);
+}
+
+void InferenceEngine::set_partitions(size_t partitions) {
+    std::atomic_store(&join_pool, partitions > 1 ? std::make_shared<worker_pool>(partitions) : nullptr);
 }
 
 void InferenceEngine::add_fact(const std::string& relation, const std::string& entity1, const std::string& entity2,
-                               const std::vector<actions::attribute_t>& attributes) {
-    std::string resolved_relation = resolve_alias(relation);
-    facts.push_back({entity1, resolved_relation, entity2, attributes});
+                               const std::vector<actions::attribute_t>& attributes, const std::string& mime_type) {
+    std::string resolved_relation = rules()->resolve_alias(relation);
+    store.add_fact({entity1, resolved_relation, entity2, attributes}, mime_type);
     std::cout << "Added fact: " << resolved_relation << "(" << entity1 << ", " << entity2 << ")";
+    if (!mime_type.empty()) std::cout << " AS " << mime_type;
     if (!attributes.empty()) {
         std::cout << " WITH ";
         for (size_t i = 0; i < attributes.size(); ++i) {
@@ -41,119 +55,224 @@ void InferenceEngine::add_fact(const std::string& relation, const std::string& e
     std::cout << "\n";
 }
 
+void InferenceEngine::add_entity_type(const std::string& entity, const std::string& mime_type) {
+    store.set_entity_type(entity, mime_type);
+    std::cout << "Added entity type: " << entity << " AS " << mime_type << "\n";
+}
+
 void InferenceEngine::add_predicate(const std::string& entity, const std::string& key, const std::string& value) {
-    predicates.push_back({entity, key, value});
+    store.add_predicate({entity, key, value});
     std::cout << "Added predicate: " << entity << " has " << key << "=\"" << value << "\"\n";
 }
 
+std::shared_ptr<const relation_graph> InferenceEngine::graph(const std::string& relation) {
+    return graphs.graph(*store.snapshot(), rules()->resolve_alias(relation));
+}
+
+std::vector<graph_hit> InferenceEngine::neighborhood(const std::string& relation, const std::string& entity,
+                                                     const traversal_options& options) {
+    auto pool = std::atomic_load(&join_pool);
+    return graph(relation)->neighborhood(entity, options, pool.get());
+}
+
+bool InferenceEngine::reachable(const std::string& relation, const std::string& from, const std::string& to,
+                                const traversal_options& options) {
+    auto pool = std::atomic_load(&join_pool);
+    return graph(relation)->reachable(from, to, options, pool.get());
+}
+
+std::vector<std::vector<std::string>> InferenceEngine::paths(const std::string& relation, const std::string& from,
+                                                             const std::string& to, const traversal_options& options) {
+    return graph(relation)->paths(from, to, options);
+}
+
 std::vector<actions::relation_t> InferenceEngine::infer(const std::string& context, int max_depth,
                                                        int max_iterations) {
-    std::vector<actions::relation_t> new_relations;
+    return infer(context, max_depth, max_iterations, infer_limits{}).relations;
+}
+
+std::future<infer_result> InferenceEngine::infer_async(const std::string& context, int max_depth,
+                                                       int max_iterations, const infer_limits& limits) {
+    return std::async(std::launch::async, [this, context, max_depth, max_iterations, limits] {
+        return infer(context, max_depth, max_iterations, limits);
+    });
+}
+
+infer_status InferenceEngine::check_limits(const infer_limits& limits) {
+    if (limits.cancel.cancelled()) return infer_status::cancelled;
+    if (limits.deadline && std::chrono::steady_clock::now() >= *limits.deadline) return infer_status::deadline_exceeded;
+    return infer_status::complete;
+}
+
+infer_result InferenceEngine::infer(const std::string& context, int max_depth, int max_iterations,
+                                    const infer_limits& limits) {
+    infer_result result;
+    result.status = infer(context, max_depth, max_iterations, limits, [&](const actions::relation_t& rel) {
+        result.relations.push_back(rel);
+        return true;
+    });
+    return result;
+}
+
+infer_status InferenceEngine::infer(const std::string& context, int max_depth, int max_iterations,
+                                    const infer_limits& limits, const relation_sink& sink) {
+    infer_status status = infer_status::complete;
+    // Derived relations are kept in a private store with the engine's storage options, so in
+    // out-of-core mode they spill to disk like ingested facts. Relations derived in the current
+    // round are buffered in `pending` and moved to the store when the buffer is full and at the
+    // end of every round.
+    fact_store derived(storage);
+    std::vector<actions::relation_t> pending;
+    std::unordered_set<std::string> pending_keys;
+    auto derived_snap = derived.snapshot();
+    size_t produced = 0;
+    auto flush = [&] {
+        if (pending.empty()) return;
+        derived.add_facts(std::move(pending));
+        pending.clear();
+        pending_keys.clear();
+        derived_snap = derived.snapshot();
+    };
+    auto rules = this->rules();
+    auto snap = store.snapshot();
     std::cout << "Starting inference: context=" << context << ", max_depth=" << max_depth
-              << ", iterations=" << max_iterations << "\n";
+              << ", iterations=" << max_iterations << ", version=" << snap->version << "\n";
+
+    auto pool = std::atomic_load(&join_pool);
+    const auto& strata = rules->strata();
+
+    // partitions scanned by the rules of each context: untyped facts plus every type the context matches
+    std::map<std::string, std::vector<const fact_partition*>> scopes;
+    for (const auto& ctx : rules->contexts()) {
+        auto& scope = scopes[ctx.mime_type];
+        if (!scope.empty()) continue;
+        for (const auto& [type, partition] : snap->partitions) {
+            if (type.empty() || rule_set::matches_context(ctx.mime_type, type)) scope.push_back(&partition);
+        }
+    }
+
+    for (size_t s = 0; s < strata.size() && status == infer_status::complete; ++s) {
+        const auto& stratum = strata[s];
+        std::vector<const rule_set::rule_node*> active;
+        for (const auto& node : stratum.rules) {
+            if (rule_set::matches_context(rules->context_of(node), context)) active.push_back(&node);
+        }
+        if (active.empty()) continue;
+        std::cout << "Stratum " << s << (stratum.recursive ? " (recursive)" : "") << "\n";
 
-    for (int iteration = 0; iteration < max_iterations; ++iteration) {
-        std::cout << "Iteration " << (iteration + 1) << "\n";
-        size_t initial_size = new_relations.size();
-        for (const auto& ctx : state.contexts) {
-            if (matches_context(ctx.mime_type, context)) {
+        // relations that received new facts in the previous round, a rule is only scheduled
+        // again when it reads one of them
+        std::set<std::string> changed;
+        std::set<std::string> round_changed;
+        for (int round = 0; status == infer_status::complete; ++round) {
+            if (max_iterations > 0 && round >= max_iterations) {
+                std::cout << "  Reached max_iterations before fixpoint\n";
+                break;
+            }
+            std::cout << "  Round " << (round + 1) << "\n";
+            // relations derived during a round only become visible to matching in the next one
+            flush();
+            auto visible = derived_snap;
+            round_changed.clear();
+            for (const auto* node : active) {
+                const auto& rule = rules->rule(*node);
+                fact_view view{*snap, *visible, &scopes[rules->context_of(*node)]};
+                if (round > 0 && std::none_of(node->inputs.begin(), node->inputs.end(),
+                                              [&](const auto& rel) { return changed.count(rel) > 0; })) {
+                    std::cout << "    Skipping rule without changed inputs: " << rule.name << "\n";
+                    continue;
+                }
+                status = check_limits(limits);
+                if (status != infer_status::complete) break;
+                std::cout << "    Applying rule: " << rule.name << " (context " << rules->context_of(*node) << ")\n";
                 int match_count = 0;
-                std::cout << "  Checking context: " << ctx.mime_type << "\n";
-                for (const auto& rule : ctx.rules) {
-                    std::cout << "    Applying rule: " << rule.name << "\n";
-                    auto matches = apply_rule(rule, max_depth);
-                    for (const auto& match : matches) {
-                        bool is_duplicate = std::any_of(new_relations.begin(), new_relations.end(), [&](const auto& r) {
-                            if (r.var1 != match.var1 || r.var2 != match.var2 || r.relation_name != match.relation_name ||
-                                r.attributes.size() != match.attributes.size()) {
-                                return false;
-                            }
-                            std::vector<actions::attribute_t> r_attrs = r.attributes;
-                            std::vector<actions::attribute_t> m_attrs = match.attributes;
-                            std::sort(r_attrs.begin(), r_attrs.end(),
-                                      [](const auto& a, const auto& b) { return a.key < b.key; });
-                            std::sort(m_attrs.begin(), m_attrs.end(),
-                                      [](const auto& a, const auto& b) { return a.key < b.key; });
-                            for (size_t i = 0; i < r_attrs.size(); ++i) {
-                                if (r_attrs[i] != m_attrs[i]) {
-                                    return false;
-                                }
-                            }
-                            return true;
-                        }) || std::any_of(facts.begin(), facts.end(), [&](const auto& f) {
-                            if (f.var1 != match.var1 || f.var2 != match.var2 || f.relation_name != match.relation_name ||
-                                f.attributes.size() != match.attributes.size()) {
-                                return false;
-                            }
-                            std::vector<actions::attribute_t> f_attrs = f.attributes;
-                            std::vector<actions::attribute_t> m_attrs = match.attributes;
-                            std::sort(f_attrs.begin(), f_attrs.end(),
-                                      [](const auto& a, const auto& b) { return a.key < b.key; });
-                            std::sort(m_attrs.begin(), m_attrs.end(),
-                                      [](const auto& a, const auto& b) { return a.key < b.key; });
-                            for (size_t i = 0; i < f_attrs.size(); ++i) {
-                                if (f_attrs[i] != m_attrs[i]) {
-                                    return false;
-                                }
-                            }
-                            return true;
-                        });
-                        if (!is_duplicate) {
-                            new_relations.push_back(match);
-                            match_count++;
-                            std::cout << "        Added relation: " << match.relation_name << "(" << match.var1
-                                      << ", " << match.var2 << ")\n";
-                        } else {
-                            std::cout << "        Skipped duplicate: " << match.relation_name << "(" << match.var1
-                                      << ", " << match.var2 << ")\n";
-                        }
+                auto emit = [&](const actions::relation_t& match) {
+                    std::string key = relation_key(match);
+                    if (pending_keys.count(key) || snap->contains(match) || derived_snap->contains(match)) {
+                        std::cout << "        Skipped duplicate: " << match.relation_name << "(" << match.var1
+                                  << ", " << match.var2 << ")\n";
+                        return true;
                     }
+                    // only a relation beyond the budget exhausts it, duplicates do not
+                    if (limits.max_relations > 0 && produced >= limits.max_relations) {
+                        status = infer_status::budget_exhausted;
+                        return false;
+                    }
+                    pending_keys.insert(std::move(key));
+                    pending.push_back(match);
+                    round_changed.insert(match.relation_name);
+                    produced++;
+                    match_count++;
+                    std::cout << "        Added relation: " << match.relation_name << "(" << match.var1
+                              << ", " << match.var2 << ")\n";
+                    if (!sink(match)) {
+                        status = infer_status::stopped;
+                        return false;
+                    }
+                    if (pending.size() >= storage.buffer_facts) flush();
+                    return true;
+                };
+                // rules with more conditions than max_depth never match, keep that for both paths
+                auto interrupted = [&] { return check_limits(limits) != infer_status::complete; };
+                const bool within_depth = max_depth > 0 && static_cast<size_t>(max_depth) >= rule.conditions.size();
+                bool finished;
+                if (pool && within_depth) {
+                    finished = partitioned_join(view, rule, *pool, interrupted, emit);
+                } else if (node->compiled && within_depth) {
+                    std::cout << "      Running compiled rule: " << rule.name << "\n";
+                    finished = node->compiled(view, interrupted, emit);
+                } else {
+                    finished = apply_rule(view, rule, max_depth, limits, emit);
                 }
+                // a deadline or cancellation interrupts the matchers without going through emit
+                if (!finished && status == infer_status::complete) status = check_limits(limits);
                 std::cout << "    Matches found: " << match_count << "\n";
+                if (status != infer_status::complete) break;
             }
-        }
-        if (new_relations.size() == initial_size) {
-            std::cout << "  No new relations in iteration " << (iteration + 1) << ", stopping\n";
-            break;
-        }
-        facts.insert(facts.end(), new_relations.begin() + initial_size, new_relations.end());
-    }
-    std::cout << "Inference complete. New relations: " << new_relations.size() << "\n";
-    for (const auto& rel : new_relations) {
-        std::cout << "New relation: " << rel.relation_name << "(" << rel.var1 << ", " << rel.var2 << ")";
-        if (!rel.attributes.empty()) {
-            std::cout << " WITH ";
-            for (size_t i = 0; i < rel.attributes.size(); ++i) {
-                std::cout << rel.attributes[i].key << "=\"" << rel.attributes[i].value << "\"";
-                if (i < rel.attributes.size() - 1) std::cout << ", ";
+            if (!stratum.recursive) break;
+            changed.swap(round_changed);
+            if (changed.empty()) {
+                std::cout << "  Fixpoint reached after round " << (round + 1) << "\n";
+                break;
             }
         }
-        std::cout << "\n";
     }
-    return new_relations;
-}
-
-bool InferenceEngine::matches_context(const std::string& rule_context, const std::string& query_context) const {
-    if (query_context == "*/*" || rule_context == "*/*") return true;
-    auto split = [](const std::string& s) {
-        auto pos = s.find('/');
-        return std::make_pair(s.substr(0, pos), pos == std::string::npos ? "" : s.substr(pos + 1));
+    if (status != infer_status::complete) {
+        std::cout << "Inference stopped early (" << to_string(status)
+                  << "), partial results delivered but not published\n";
+    }
+    std::cout << "Inference complete. New relations: " << produced << "\n";
+    if (status != infer_status::complete || !limits.publish) return status;
+    flush();
+    // published in batches of at most buffer_facts, each batch becomes a new version; relations
+    // that a concurrent inference published since our snapshot was taken are skipped
+    std::vector<actions::relation_t> batch;
+    auto publish = [&] {
+        uint64_t version = store.add_new_facts(std::move(batch));
+        std::cout << "Published derived relations as version " << version << "\n";
+        batch.clear();
     };
-    auto [rule_type, rule_subtype] = split(rule_context);
-    auto [query_type, query_subtype] = split(query_context);
-
-    return (rule_type == query_type || rule_type == "*" || query_type == "*") &&
-           (rule_subtype == query_subtype || rule_subtype == "*" || query_subtype == "*");
+    derived_snap->for_each_fact([&](const actions::relation_t& rel) {
+        batch.push_back(rel);
+        if (batch.size() >= storage.buffer_facts) publish();
+        return true;
+    });
+    if (!batch.empty()) publish();
+    return status;
 }
 
-std::string InferenceEngine::resolve_alias(const std::string& relation) const {
-    auto it = state.aliases.find(relation);
-    std::string resolved = it != state.aliases.end() ? it->second : relation;
-    std::cout << "      Resolving alias: " << relation << " -> " << resolved << "\n";
-    return resolved;
+std::string InferenceEngine::relation_key(const actions::relation_t& rel) {
+    std::vector<actions::attribute_t> attrs = rel.attributes;
+    std::sort(attrs.begin(), attrs.end(),
+              [](const auto& a, const auto& b) { return std::tie(a.key, a.value) < std::tie(b.key, b.value); });
+    std::string key = rel.relation_name + '\x1f' + rel.var1 + '\x1f' + rel.var2;
+    for (const auto& attr : attrs) {
+        key += '\x1f' + attr.key + '\x1e' + attr.value;
+    }
+    return key;
 }
 
-bool InferenceEngine::matches_condition(const actions::condition_t& condition,
+bool InferenceEngine::matches_condition(const fact_view& view, const actions::condition_t& condition,
                                        std::map<std::string, std::string>& bindings, int depth) const {
     if (depth <= 0) return false;
 
@@ -162,39 +281,47 @@ bool InferenceEngine::matches_condition(const actions::condition_t& condition,
             using T = std::decay_t<decltype(cond)>;
             if constexpr (std::is_same_v<T, actions::relation_t>) {
                 std::cout << "      Checking relation: " << cond.var1 << " ~" << cond.relation_name << " " << cond.var2 << "\n";
-                std::string resolved_relation = resolve_alias(cond.relation_name);
-                for (const auto& fact : facts) {
-                    if (fact.relation_name == resolved_relation) {
-                        std::map<std::string, std::string> new_bindings = bindings;
-                        bool vars_unbound = new_bindings.find(cond.var1) == new_bindings.end() &&
-                                           new_bindings.find(cond.var2) == new_bindings.end();
-                        bool vars_match = new_bindings.count(cond.var1) && new_bindings[cond.var1] == fact.var1 &&
-                                          new_bindings.count(cond.var2) && new_bindings[cond.var2] == fact.var2;
-                        if (vars_unbound || vars_match) {
-                            new_bindings[cond.var1] = fact.var1;
-                            new_bindings[cond.var2] = fact.var2;
-                            bool attributes_match = true;
-                            for (const auto& attr : cond.attributes) {
-                                std::cout << "        Checking attribute: " << attr.key << "=" << attr.value << "\n";
-                                auto it = std::find_if(fact.attributes.begin(), fact.attributes.end(),
-                                                       [&](const auto& fa) { return fa == attr; });
-                                if (it == fact.attributes.end()) {
-                                    std::cout << "        Attribute mismatch: " << attr.key << "=" << attr.value << "\n";
-                                    attributes_match = false;
-                                    break;
-                                }
-                            }
-                            if (attributes_match) {
-                                std::cout << "        Match found: " << fact.var1 << " ~" << resolved_relation
-                                          << " " << fact.var2 << "\n";
-                                std::cout << "        New bindings: " << cond.var1 << "=" << fact.var1 << ", "
-                                          << cond.var2 << "=" << fact.var2 << "\n";
-                                bindings = new_bindings;
-                                return true;
+                const std::string& resolved_relation = cond.relation_name;
+                auto match = [&](const auto& fact) {
+                    std::map<std::string, std::string> new_bindings = bindings;
+                    bool vars_unbound = new_bindings.find(cond.var1) == new_bindings.end() &&
+                                       new_bindings.find(cond.var2) == new_bindings.end();
+                    bool vars_match = new_bindings.count(cond.var1) && new_bindings[cond.var1] == fact.var1 &&
+                                      new_bindings.count(cond.var2) && new_bindings[cond.var2] == fact.var2;
+                    // a variable used on both sides only matches facts relating an entity to itself
+                    bool same_var = cond.var1 != cond.var2 || fact.var1 == fact.var2;
+                    if ((vars_unbound || vars_match) && same_var) {
+                        new_bindings[cond.var1] = fact.var1;
+                        new_bindings[cond.var2] = fact.var2;
+                        bool attributes_match = true;
+                        for (const auto& attr : cond.attributes) {
+                            std::cout << "        Checking attribute: " << attr.key << "=" << attr.value << "\n";
+                            auto it = std::find_if(fact.attributes.begin(), fact.attributes.end(),
+                                                   [&](const auto& fa) { return fa == attr; });
+                            if (it == fact.attributes.end()) {
+                                std::cout << "        Attribute mismatch: " << attr.key << "=" << attr.value << "\n";
+                                attributes_match = false;
+                                break;
                             }
                         }
+                        if (attributes_match) {
+                            std::cout << "        Match found: " << fact.var1 << " ~" << resolved_relation
+                                      << " " << fact.var2 << "\n";
+                            std::cout << "        New bindings: " << cond.var1 << "=" << fact.var1 << ", "
+                                      << cond.var2 << "=" << fact.var2 << "\n";
+                            bindings = new_bindings;
+                            return false;
+                        }
                     }
-                }
+                    return true;
+                };
+                // copied, a match overwrites bindings
+                auto bound = bindings.find(cond.var1);
+                const std::optional<std::string> var1 =
+                    bound != bindings.end() ? std::optional<std::string>(bound->second) : std::nullopt;
+                bool found = !(var1 ? view.for_each_fact(resolved_relation, *var1, match)
+                                    : view.for_each_fact(resolved_relation, match));
+                if (found) return true;
                 std::cout << "        No match for relation: " << cond.var1 << " ~" << resolved_relation << " " << cond.var2 << "\n";
                 return false;
             } else if constexpr (std::is_same_v<T, actions::predicate_t>) {
@@ -205,11 +332,9 @@ bool InferenceEngine::matches_condition(const actions::condition_t& condition,
                     return false;
                 }
                 const std::string& entity = it->second;
-                for (const auto& pred : predicates) {
-                    if (pred.var == entity && pred.key == cond.key && pred.value == cond.value) {
-                        std::cout << "        Match found: " << entity << " has " << pred.key << "=\"" << pred.value << "\"\n";
-                        return true;
-                    }
+                if (view.snapshot.has_predicate(entity, cond.key, cond.value)) {
+                    std::cout << "        Match found: " << entity << " has " << cond.key << "=\"" << cond.value << "\"\n";
+                    return true;
                 }
                 std::cout << "        No predicate match for " << entity << " has " << cond.key << "=\"" << cond.value << "\"\n";
                 return false;
@@ -219,91 +344,99 @@ bool InferenceEngine::matches_condition(const actions::condition_t& condition,
         condition.value);
 }
 
-std::vector<actions::relation_t> InferenceEngine::apply_rule(const actions::rule_t& rule, int max_depth) const {
-    std::vector<actions::relation_t> new_relations;
+bool InferenceEngine::apply_rule(const fact_view& view, const actions::rule_t& rule, int max_depth,
+                                 const infer_limits& limits, const relation_sink& emit) const {
     std::cout << "      Checking conditions for rule: " << rule.name << "\n";
-    if (rule.conditions.empty()) return new_relations;
+    if (rule.conditions.empty()) return true;
 
-    std::vector<std::map<std::string, std::string>> all_bindings;
+    size_t binding_count = 0;
+    auto conclude = [&](const std::map<std::string, std::string>& bindings) {
+        binding_count++;
+        std::cout << "      Bindings: ";
+        for (const auto& [var, val] : bindings) {
+            std::cout << var << "=" << val << " ";
+        }
+        std::cout << "\n";
+        const auto& conclusion = rule.conclusion;
+        actions::relation_t new_relation;
+        new_relation.var1 = bindings.count(conclusion.var1) ? bindings.at(conclusion.var1) : "";
+        new_relation.var2 = bindings.count(conclusion.var2) ? bindings.at(conclusion.var2) : "";
+        new_relation.relation_name = conclusion.relation_name;
+        new_relation.attributes = conclusion.attributes;
+        if (new_relation.var1.empty() || new_relation.var2.empty()) {
+            std::cout << "      Skipped relation due to empty vars: " << new_relation.relation_name << "\n";
+            return true;
+        }
+        std::cout << "      Rule applied: New relation " << new_relation.relation_name << "(" << new_relation.var1
+                  << ", " << new_relation.var2 << ")";
+        if (!new_relation.attributes.empty()) {
+            std::cout << " WITH ";
+            for (size_t i = 0; i < new_relation.attributes.size(); ++i) {
+                std::cout << new_relation.attributes[i].key << "=\"" << new_relation.attributes[i].value << "\"";
+                if (i < new_relation.attributes.size() - 1) std::cout << ", ";
+            }
+        }
+        std::cout << "\n";
+        return emit(new_relation);
+    };
+
+    // returns false once emit asked to stop or a limit was hit
     auto check_conditions = [&](const auto& self, size_t cond_idx, std::map<std::string, std::string>& bindings,
-                               int depth) -> void {
+                               int depth) -> bool {
         if (cond_idx >= rule.conditions.size()) {
-            all_bindings.push_back(bindings);
-            return;
+            return conclude(bindings);
         }
-        if (depth <= 0) return;
+        if (depth <= 0) return true;
 
         std::map<std::string, std::string> new_bindings = bindings;
-        if (matches_condition(rule.conditions[cond_idx], new_bindings, depth)) {
+        if (matches_condition(view, rule.conditions[cond_idx], new_bindings, depth)) {
             std::cout << "        Condition " << cond_idx << " matched with bindings: ";
             for (const auto& [var, val] : new_bindings) {
                 std::cout << var << "=" << val << " ";
             }
             std::cout << "\n";
-            self(self, cond_idx + 1, new_bindings, depth - 1);
+            if (!self(self, cond_idx + 1, new_bindings, depth - 1)) return false;
         }
-        // Only iterate facts for multi-condition rules to avoid duplicate bindings
-        if (rule.conditions.size() > 1 && std::holds_alternative<actions::relation_t>(rule.conditions[cond_idx].value)) {
+        // Iterate all facts of relation conditions, duplicate bindings are removed by the caller
+        if (std::holds_alternative<actions::relation_t>(rule.conditions[cond_idx].value)) {
             const auto& cond = std::get<actions::relation_t>(rule.conditions[cond_idx].value);
-            std::string resolved_relation = resolve_alias(cond.relation_name);
-            for (const auto& fact : facts) {
-                if (fact.relation_name == resolved_relation) {
-                    new_bindings = bindings;
-                    if ((new_bindings.count(cond.var1) == 0 || new_bindings[cond.var1] == fact.var1) &&
-                        (new_bindings.count(cond.var2) == 0 || new_bindings[cond.var2] == fact.var2)) {
-                        new_bindings[cond.var1] = fact.var1;
-                        new_bindings[cond.var2] = fact.var2;
-                        bool attributes_match = true;
-                        for (const auto& attr : cond.attributes) {
-                            auto it = std::find_if(fact.attributes.begin(), fact.attributes.end(),
-                                                   [&](const auto& fa) { return fa == attr; });
-                            if (it == fact.attributes.end()) {
-                                attributes_match = false;
-                                break;
-                            }
-                        }
-                        if (attributes_match && matches_condition(rule.conditions[cond_idx], new_bindings, depth)) {
-                            self(self, cond_idx + 1, new_bindings, depth - 1);
+            const std::string& resolved_relation = cond.relation_name;
+            auto visit = [&](const auto& fact) {
+                if (limits.cancel.cancelled() ||
+                    (limits.deadline && std::chrono::steady_clock::now() >= *limits.deadline)) {
+                    return false;
+                }
+                new_bindings = bindings;
+                if ((new_bindings.count(cond.var1) == 0 || new_bindings[cond.var1] == fact.var1) &&
+                    (new_bindings.count(cond.var2) == 0 || new_bindings[cond.var2] == fact.var2)) {
+                    new_bindings[cond.var1] = fact.var1;
+                    new_bindings[cond.var2] = fact.var2;
+                    bool attributes_match = true;
+                    for (const auto& attr : cond.attributes) {
+                        auto it = std::find_if(fact.attributes.begin(), fact.attributes.end(),
+                                               [&](const auto& fa) { return fa == attr; });
+                        if (it == fact.attributes.end()) {
+                            attributes_match = false;
+                            break;
                         }
                     }
+                    if (attributes_match && matches_condition(view, rule.conditions[cond_idx], new_bindings, depth)) {
+                        return self(self, cond_idx + 1, new_bindings, depth - 1);
+                    }
                 }
-            }
+                return true;
+            };
+            // a bound first entity is looked up in the sorted segments instead of scanning them
+            auto bound = bindings.find(cond.var1);
+            return bound != bindings.end() ? view.for_each_fact(resolved_relation, bound->second, visit)
+                                           : view.for_each_fact(resolved_relation, visit);
         }
+        return true;
     };
 
     std::map<std::string, std::string> initial_bindings;
-    check_conditions(check_conditions, 0, initial_bindings, max_depth);
-
-    std::cout << "      Total bindings sets: " << all_bindings.size() << "\n";
-    for (const auto& bindings : all_bindings) {
-        std::cout << "      Bindings: ";
-        for (const auto& [var, val] : bindings) {
-            std::cout << var << "=" << val << " ";
-        }
-        std::cout << "\n";
-        const auto& conclusion = rule.conclusion;
-        actions::relation_t new_relation;
-        new_relation.var1 = bindings.count(conclusion.var1) ? bindings.at(conclusion.var1) : "";
-        new_relation.var2 = bindings.count(conclusion.var2) ? bindings.at(conclusion.var2) : "";
-        new_relation.relation_name = resolve_alias(conclusion.relation_name);
-        new_relation.attributes = conclusion.attributes;
-        if (!new_relation.var1.empty() && !new_relation.var2.empty()) {
-            std::cout << "      Rule applied: New relation " << new_relation.relation_name << "(" << new_relation.var1
-                      << ", " << new_relation.var2 << ")";
-            if (!new_relation.attributes.empty()) {
-                std::cout << " WITH ";
-                for (size_t i = 0; i < new_relation.attributes.size(); ++i) {
-                    std::cout << new_relation.attributes[i].key << "=\"" << new_relation.attributes[i].value << "\"";
-                    if (i < new_relation.attributes.size() - 1) std::cout << ", ";
-                }
-            }
-            std::cout << "\n";
-            new_relations.push_back(new_relation);
-        } else {
-            std::cout << "      Skipped relation due to empty vars: " << new_relation.relation_name << "\n";
-        }
-    }
-
-    return new_relations;
+    bool finished = check_conditions(check_conditions, 0, initial_bindings, max_depth);
+    std::cout << "      Total bindings sets: " << binding_count << "\n";
+    return finished;
 }
 } // namespace sen
\ No newline at end of file
@@ -1,33 +1,129 @@
 #pragma once
 
 #include "sen_grammar.h"
+#include "fact_store.h"
+#include "relation_graph.h"
+#include "rule_set.h"
+#include "worker_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 #include <map>
 #include <variant>
 
 namespace sen {
+// Shared flag for cancelling a running inference from another thread, copies share state.
+class cancellation_token {
+public:
+    cancellation_token() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+    void cancel() const { flag->store(true, std::memory_order_relaxed); }
+    bool cancelled() const { return flag->load(std::memory_order_relaxed); }
+
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+// Only a run that completes publishes its derived relations to the fact store. A run stopped
+// by any limit or by its sink leaves the store unchanged and returns without publishing, its
+// partial results only reach the caller. Publishing is not bounded by the deadline; it costs
+// a duplicate check per relation, set publish to false to keep the whole call within it.
+struct infer_limits {
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    // 0 = unlimited, a run deriving exactly max_relations relations before its fixpoint completes
+    size_t max_relations = 0;
+    cancellation_token cancel;
+    bool publish = true;
+};
+
+enum class infer_status { complete, deadline_exceeded, budget_exhausted, cancelled, stopped };
+std::string to_string(infer_status status);
+
+// Receives each derived relation as soon as it is produced, returning false stops inference.
+using relation_sink = std::function<bool(const actions::relation_t&)>;
+
+// Relations derived until inference finished or hit one of its limits.
+struct infer_result {
+    std::vector<actions::relation_t> relations;
+    infer_status status = infer_status::complete;
+};
+
 class InferenceEngine {
 public:
+    InferenceEngine();
+    // Set storage.directory to keep facts beyond the in-memory write buffer in mapped segment files.
+    explicit InferenceEngine(std::shared_ptr<const rule_set> rules, const fact_store_options& storage = {});
+
+    // Replaces the rule set, inferences already running keep using the one they started with.
     void parse(const std::string& dsl);
+    void set_rules(std::shared_ptr<const rule_set> rules);
+    std::shared_ptr<const rule_set> rules() const;
+
+    // Facts are stored in the partition of their MIME type, which defaults to the type of entity1.
+    // Rules of a context only scan untyped facts and the partitions their context matches.
     void add_fact(const std::string& relation, const std::string& entity1, const std::string& entity2,
-                  const std::vector<actions::attribute_t>& attributes = {});
+                  const std::vector<actions::attribute_t>& attributes = {}, const std::string& mime_type = "");
+    void add_entity_type(const std::string& entity, const std::string& mime_type);
     void add_predicate(const std::string& entity, const std::string& key, const std::string& value);
+    // Runs against the snapshot current at the time of the call, concurrent ingest is not
+    // observed. Derived relations are published to the fact store when inference completes,
+    // in batches of at most storage.buffer_facts, see infer_limits. They are published untyped,
+    // so rules of every context see them in later runs just as they did during this one.
+    // Rules are evaluated stratum by stratum, recursive strata until fixpoint or at most
+    // max_iterations rounds if it is positive.
     std::vector<actions::relation_t> infer(const std::string& context = "*/*", int max_depth = 2,
-                                          int max_iterations = 2);
+                                          int max_iterations = 0);
+    infer_result infer(const std::string& context, int max_depth, int max_iterations, const infer_limits& limits);
+    // Streams derived relations into sink instead of collecting them, use limits.max_relations
+    // or return false from the sink to stop early. The engine still keeps every derived relation
+    // for deduplication and later rounds; with storage.directory set they spill to disk beyond
+    // storage.buffer_facts, otherwise they stay in memory until inference returns.
+    infer_status infer(const std::string& context, int max_depth, int max_iterations, const infer_limits& limits,
+                       const relation_sink& sink);
+    // Runs inference on a separate thread, the engine must outlive the returned future.
+    std::future<infer_result> infer_async(const std::string& context = "*/*", int max_depth = 2,
+                                          int max_iterations = 0, const infer_limits& limits = {});
 
-private:
-    using fact_t = actions::relation_t;
-    using predicate_t = actions::predicate_t;
+    std::shared_ptr<const fact_snapshot> snapshot() const { return store.snapshot(); }
+
+    // Adjacency of a relation in the current snapshot, only segments added since the previous
+    // call are indexed, and not even those while the snapshot is unchanged. The graph stays
+    // valid and unchanged while facts are added; graph->stale(*snapshot()) tells whether it may
+    // be out of date, which any newer version makes it, even one that added no facts of the
+    // relation.
+    std::shared_ptr<const relation_graph> graph(const std::string& relation);
+    // Traversals of the current snapshot, frontiers are expanded on the join workers if
+    // set_partitions enabled them.
+    std::vector<graph_hit> neighborhood(const std::string& relation, const std::string& entity,
+                                        const traversal_options& options = {});
+    bool reachable(const std::string& relation, const std::string& from, const std::string& to,
+                   const traversal_options& options = {});
+    std::vector<std::vector<std::string>> paths(const std::string& relation, const std::string& from,
+                                                const std::string& to, const traversal_options& options = {});
 
-    actions::rule_state state;
-    std::vector<fact_t> facts;
-    std::vector<predicate_t> predicates;
+    // Number of worker threads used to evaluate each rule as a parallel hash join, 1 keeps the
+    // sequential matcher: the rule's compiled code if sen-rulegen generated it, otherwise the
+    // interpreter. All of them compute the same relations. The workers are kept
+    // alive until the next call, inferences already running keep the pool they started with.
+    void set_partitions(size_t partitions);
+
+private:
+    std::shared_ptr<const rule_set> current_rules;   // only accessed through std::atomic_load/store
+    const fact_store_options storage;
+    fact_store store;
+    std::shared_ptr<worker_pool> join_pool;   // null for the nested-loop matcher, only accessed through std::atomic_load/store
+    graph_index graphs;
 
-    bool matches_context(const std::string& rule_context, const std::string& query_context) const;
-    std::string resolve_alias(const std::string& relation) const;
-    bool matches_condition(const actions::condition_t& condition,
+    bool matches_condition(const fact_view& view, const actions::condition_t& condition,
                           std::map<std::string, std::string>& bindings, int depth) const;
-    std::vector<fact_t> apply_rule(const actions::rule_t& rule, int max_depth) const;
+    bool apply_rule(const fact_view& view, const actions::rule_t& rule, int max_depth, const infer_limits& limits,
+                    const relation_sink& emit) const;
+    static std::string relation_key(const actions::relation_t& rel);
+    static infer_status check_limits(const infer_limits& limits);
 };
 } // namespace sen
\ No newline at end of file
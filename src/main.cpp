@@ -1,55 +1,18 @@
 // main.cpp
 #include <iostream>
 #include "inference_engine.h"
+#include "example_rules.h"
 
 int main() {
-    std::string dsl = R"dsl(
-        USE relation/family-link AS genealogy
-        USE relation/book-quote AS quotation
-        USE relation/locality AS locality
-
-        CONTEXT text/* {
-            RULE quoted_by {
-                IF (A ~quotation B)
-                THEN RELATE(B, A, "quotation") WITH type="inverse", label="quoted by"
-            }
-        }
-        CONTEXT application/person {
-            RULE father_of {
-                IF (A ~genealogy B AND role="parent of" AND A HAS gender="male")
-                THEN RELATE(A, B, "genealogy") WITH label="father of"
-            }
-            RULE child_of {
-                IF (A ~genealogy B AND role="parent of")
-                THEN RELATE(B, A, "genealogy") WITH label="child of"
-            }
-            RULE son_of {
-                IF (A ~genealogy B AND role="parent of" AND B HAS gender="male")
-                THEN RELATE(B, A, "genealogy") WITH label="son of"
-            }
-            RULE daughter_of {
-                IF (A ~genealogy B AND role="parent of" AND B HAS gender="female")
-                THEN RELATE(A, B, "genealogy") WITH label="daughter of"
-            }
-        }
-        CONTEXT entity/place {
-            RULE contained_location {
-                IF (A ~locality B AND role="located in" AND B ~locality C AND role="located in")
-                THEN RELATE(A, C, "locality") WITH role="located in")
-            }
-        }
-        CONTEXT */* {
-            RULE transitive {
-                IF (A ~genealogy B AND role="parent of" AND B ~genealogy C AND role="parent of")
-                THEN RELATE(A, C, "grand_parent_of") WITH role="grandparent"
-            }
-        }
-    )dsl";
-
-    sen::InferenceEngine engine;
-    engine.parse(dsl);
+    // the compiled rule set can be shared by any number of engines; sen-rulegen also compiled
+    // these rules ahead of time, so they run as generated code
+    auto rules = sen::rule_set::parse(example_rules);
+    sen::InferenceEngine engine(rules);
 
     // family example
+    engine.add_entity_type("John", "application/person");
+    engine.add_entity_type("Mary", "application/person");
+    engine.add_entity_type("Bob", "application/person");
     engine.add_predicate("John", "gender", "male");
     engine.add_predicate("Mary", "gender", "female");
     engine.add_predicate("Bob", "gender", "male");
@@ -57,16 +20,16 @@ int main() {
     engine.add_fact("genealogy", "Mary", "Bob", {{"role", "parent of"}});
 
     // quotation example
-    engine.add_fact("quotes", "Book1", "Quote1", {});
+    engine.add_fact("quotes", "Book1", "Quote1", {}, "text/plain");
 
     // locality example
+    engine.add_entity_type("Vienna", "entity/place");
+    engine.add_entity_type("Austria", "entity/place");
     engine.add_fact("locality", "Vienna", "Austria", {{"role", "located in"}});
     engine.add_fact("locality", "Austria", "Europe", {{"role", "located in"}});
 
-    std::cout << "First run (context */*, max_depth=2, iterations=2):\n";
-    auto new_relations = engine.infer("*/*", 2, 2);
-
-    for (const auto& rel : new_relations) {
+    std::cout << "First run (context */*, max_depth=2, until fixpoint):\n";
+    engine.infer("*/*", 2, 0, {}, [](const sen::actions::relation_t& rel) {
         std::string relation_name = rel.relation_name;
         std::string relation_from = rel.var1;
         std::string relation_to   = rel.var2;
@@ -83,6 +46,15 @@ int main() {
             }
         }
         std::cout << "\n";
+        return true;
+    });
+
+    std::cout << "Places containing Vienna:\n";
+    sen::traversal_options containing;
+    containing.max_hops = 0;
+    containing.edge_attributes = {{"role", "located in"}};
+    for (const auto& hit : engine.neighborhood("locality", "Vienna", containing)) {
+        std::cout << "  " << hit.entity << " (" << hit.hops << " hops)\n";
     }
 
     return 0;
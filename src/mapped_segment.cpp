@@ -0,0 +1,182 @@
+#include "mapped_segment.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sen {
+namespace {
+uint32_t read_u32(const char* data, uint64_t& offset) {
+    uint32_t value;
+    std::memcpy(&value, data + offset, sizeof(value));
+    offset += sizeof(value);
+    return value;
+}
+
+void read_string(const char* data, uint64_t& offset, std::string& out) {
+    uint32_t size = read_u32(data, offset);
+    out.assign(data + offset, size);
+    offset += size;
+}
+} // namespace
+
+// Segment files are private spill files of one process, records are stored in host byte order:
+//   var1, var2, attribute count, then key and value of each attribute,
+// with every string prefixed by its 32-bit length.
+mapped_segment::mapped_segment(const std::string& path, std::vector<relation_entry> directory, size_t fact_count)
+    : directory(std::move(directory)), fact_count(fact_count) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Cannot open segment " + path);
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat segment " + path);
+    }
+    length = static_cast<size_t>(info.st_size);
+    if (length > 0) {
+        void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map segment " + path);
+        }
+        data = static_cast<const char*>(mapping);
+    }
+    ::close(fd);
+    // never reopened, the mapping keeps the data alive and the space is freed even if the
+    // process is killed
+    ::unlink(path.c_str());
+}
+
+mapped_segment::~mapped_segment() {
+    if (data) ::munmap(const_cast<char*>(data), length);
+}
+
+const mapped_segment::relation_entry* mapped_segment::find(const std::string& relation) const {
+    auto it = std::lower_bound(directory.begin(), directory.end(), relation,
+                               [](const auto& entry, const std::string& name) { return entry.name < name; });
+    return it == directory.end() || it->name != relation ? nullptr : &*it;
+}
+
+uint64_t mapped_segment::seek(const relation_entry& entry, const std::string& var1) const {
+    std::string first;
+    auto before = [&](uint64_t offset) {
+        read_string(data, offset, first);
+        return first < var1;
+    };
+    auto it = std::partition_point(entry.checkpoints.begin(), entry.checkpoints.end(), before);
+    size_t block = it == entry.checkpoints.begin() ? 0 : it - entry.checkpoints.begin() - 1;
+    return block * checkpoint_interval;
+}
+
+bool mapped_segment::contains(const actions::relation_t& fact) const {
+    const auto* entry = find(fact.relation_name);
+    if (!entry) return false;
+    // start at the last checkpoint ordered before the fact, an equal fact can only follow it
+    std::string var1, var2;
+    auto before = [&](uint64_t offset) {
+        read_string(data, offset, var1);
+        read_string(data, offset, var2);
+        return std::tie(var1, var2) < std::tie(fact.var1, fact.var2);
+    };
+    auto first = std::partition_point(entry->checkpoints.begin(), entry->checkpoints.end(), before);
+    size_t block = first == entry->checkpoints.begin() ? 0 : first - entry->checkpoints.begin() - 1;
+    actions::relation_t current;
+    uint64_t offset = entry->checkpoints[block];
+    for (uint64_t i = block * checkpoint_interval; i < entry->count; ++i) {
+        offset = decode(offset, current);
+        if (std::tie(current.var1, current.var2) < std::tie(fact.var1, fact.var2)) continue;
+        if (current.var1 != fact.var1 || current.var2 != fact.var2) return false;
+        if (same_attributes(current.attributes, fact.attributes)) return true;
+    }
+    return false;
+}
+
+uint64_t mapped_segment::decode(uint64_t offset, actions::relation_t& fact) const {
+    read_string(data, offset, fact.var1);
+    read_string(data, offset, fact.var2);
+    fact.attributes.resize(read_u32(data, offset));
+    for (auto& attr : fact.attributes) {
+        read_string(data, offset, attr.key);
+        read_string(data, offset, attr.value);
+    }
+    return offset;
+}
+
+mapped_segment::cursor::cursor(const mapped_segment& segment, const std::string& relation) : segment(segment) {
+    if (const auto* entry = segment.find(relation)) {
+        current.relation_name = relation;
+        count = entry->count;
+        offset = entry->offset;
+        if (count > 0) offset = segment.decode(offset, current);
+    }
+}
+
+void mapped_segment::cursor::next() {
+    if (++index < count) offset = segment.decode(offset, current);
+}
+
+segment_writer::segment_writer(const std::string& path) : path(path) {
+    // never take over an existing file, it may still be mapped by a live segment
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) throw std::runtime_error("Cannot create segment " + path + ": " + std::strerror(errno));
+    ::close(fd);
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        ::unlink(path.c_str());
+        throw std::runtime_error("Cannot open segment " + path);
+    }
+}
+
+segment_writer::~segment_writer() {
+    if (finished) return;
+    out.close();
+    ::unlink(path.c_str());
+}
+
+void segment_writer::begin_relation(const std::string& relation) {
+    if (!directory.empty() && directory.back().name >= relation) {
+        throw std::logic_error("Segment relations must be written in ascending order");
+    }
+    directory.push_back({relation, offset, 0, {}});
+}
+
+void segment_writer::add(const actions::relation_t& fact) {
+    auto& entry = directory.back();
+    if (entry.count % mapped_segment::checkpoint_interval == 0) entry.checkpoints.push_back(offset);
+    write_string(fact.var1);
+    write_string(fact.var2);
+    write_u32(static_cast<uint32_t>(fact.attributes.size()));
+    for (const auto& attr : fact.attributes) {
+        write_string(attr.key);
+        write_string(attr.value);
+    }
+    if (!out) throw std::runtime_error("Cannot write segment " + path);
+    entry.count++;
+    fact_count++;
+}
+
+std::shared_ptr<const mapped_segment> segment_writer::finish() {
+    out.close();
+    if (!out) throw std::runtime_error("Cannot write segment " + path);
+    std::cout << "Wrote segment " << path << ": " << fact_count << " facts, " << directory.size()
+              << " relations, " << offset << " bytes\n";
+    auto segment = std::make_shared<const mapped_segment>(path, std::move(directory), fact_count);
+    finished = true;
+    return segment;
+}
+
+void segment_writer::write_u32(uint32_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    offset += sizeof(value);
+}
+
+void segment_writer::write_string(const std::string& value) {
+    write_u32(static_cast<uint32_t>(value.size()));
+    out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    offset += value.size();
+}
+} // namespace sen
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "sen_grammar.h"
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace sen {
+// Segments order facts by relation, then by their entities.
+inline bool fact_less(const actions::relation_t& a, const actions::relation_t& b) {
+    return std::tie(a.relation_name, a.var1, a.var2) < std::tie(b.relation_name, b.var1, b.var2);
+}
+
+inline bool same_attributes(const std::vector<actions::attribute_t>& a, const std::vector<actions::attribute_t>& b) {
+    return a.size() == b.size() && std::is_permutation(a.begin(), a.end(), b.begin());
+}
+
+// An immutable, memory-mapped file of facts sorted by fact_less.
+// Facts are decoded on access, so reads go through the page cache and only the relation
+// directory is held in memory. The file is unlinked as soon as it is mapped, so its space is
+// released with the last reference or when the process exits, however it ends.
+class mapped_segment {
+public:
+    // Offsets of every checkpoint_interval-th record are kept for binary search.
+    static constexpr uint64_t checkpoint_interval = 128;
+
+    struct relation_entry {
+        std::string name;
+        uint64_t offset;
+        uint64_t count;
+        std::vector<uint64_t> checkpoints;
+    };
+
+    // Reads the facts of one relation in order, the current fact is valid until next().
+    class cursor {
+    public:
+        cursor(const mapped_segment& segment, const std::string& relation);
+        bool valid() const { return index < count; }
+        const actions::relation_t& fact() const { return current; }
+        void next();
+
+    private:
+        const mapped_segment& segment;
+        uint64_t offset = 0;
+        uint64_t index = 0;
+        uint64_t count = 0;
+        actions::relation_t current;
+    };
+
+    mapped_segment(const std::string& path, std::vector<relation_entry> directory, size_t fact_count);
+    ~mapped_segment();
+    mapped_segment(const mapped_segment&) = delete;
+    mapped_segment& operator=(const mapped_segment&) = delete;
+
+    size_t size() const { return fact_count; }
+    const std::vector<relation_entry>& relations() const { return directory; }
+
+    // The fact passed to the callback is only valid until it returns.
+    template<typename F>
+    bool for_each_fact(F&& f) const {
+        for (const auto& entry : directory) {
+            if (!for_each_in(entry, 0, entry.count, f)) return false;
+        }
+        return true;
+    }
+
+    template<typename F>
+    bool for_each_fact(const std::string& relation, F&& f) const {
+        const auto* entry = find(relation);
+        return !entry || for_each_in(*entry, 0, entry->count, f);
+    }
+
+    // Facts of the relation whose first entity is var1, found by binary search over the checkpoints.
+    template<typename F>
+    bool for_each_fact(const std::string& relation, const std::string& var1, F&& f) const {
+        const auto* entry = find(relation);
+        if (!entry || entry->count == 0) return true;
+        actions::relation_t fact;
+        fact.relation_name = entry->name;
+        uint64_t index = seek(*entry, var1);
+        uint64_t offset = entry->checkpoints[index / checkpoint_interval];
+        for (; index < entry->count; ++index) {
+            offset = decode(offset, fact);
+            if (fact.var1 < var1) continue;
+            if (fact.var1 != var1) return true;
+            if (!f(static_cast<const actions::relation_t&>(fact))) return false;
+        }
+        return true;
+    }
+
+    // Visits share `part` of `parts` disjoint shares of the relation's facts, split at checkpoints
+    // so that the shares can be scanned in parallel.
+    template<typename F>
+    bool for_each_fact(const std::string& relation, size_t part, size_t parts, F&& f) const {
+        const auto* entry = find(relation);
+        if (!entry) return true;
+        const size_t blocks = entry->checkpoints.size();
+        const uint64_t first = blocks * part / parts * checkpoint_interval;
+        const uint64_t last = std::min<uint64_t>(blocks * (part + 1) / parts * checkpoint_interval, entry->count);
+        return for_each_in(*entry, first, last, f);
+    }
+
+    // Whether an equal fact is stored, attributes are compared regardless of their order.
+    bool contains(const actions::relation_t& fact) const;
+
+private:
+    std::vector<relation_entry> directory;
+    size_t fact_count;
+    const char* data = nullptr;
+    size_t length = 0;
+
+    const relation_entry* find(const std::string& relation) const;
+    // Index of the checkpoint at or before the first fact of the relation with this first entity.
+    uint64_t seek(const relation_entry& entry, const std::string& var1) const;
+    uint64_t decode(uint64_t offset, actions::relation_t& fact) const;
+
+    // first must be a multiple of checkpoint_interval
+    template<typename F>
+    bool for_each_in(const relation_entry& entry, uint64_t first, uint64_t last, F& f) const {
+        if (first >= last) return true;
+        actions::relation_t fact;
+        fact.relation_name = entry.name;
+        uint64_t offset = entry.checkpoints[first / checkpoint_interval];
+        for (uint64_t i = first; i < last; ++i) {
+            offset = decode(offset, fact);
+            if (!f(static_cast<const actions::relation_t&>(fact))) return false;
+        }
+        return true;
+    }
+};
+
+// Streams facts into a new segment file, relation by relation in ascending name order and
+// the facts of each relation in fact_less order.
+// The file must not exist yet. Throws std::runtime_error on I/O errors, the file is removed
+// unless finish() succeeded.
+class segment_writer {
+public:
+    explicit segment_writer(const std::string& path);
+    ~segment_writer();
+    segment_writer(const segment_writer&) = delete;
+    segment_writer& operator=(const segment_writer&) = delete;
+
+    void begin_relation(const std::string& relation);
+    void add(const actions::relation_t& fact);
+    std::shared_ptr<const mapped_segment> finish();
+
+private:
+    std::string path;
+    std::ofstream out;
+    uint64_t offset = 0;
+    size_t fact_count = 0;
+    bool finished = false;
+    std::vector<mapped_segment::relation_entry> directory;
+
+    void write_u32(uint32_t value);
+    void write_string(const std::string& value);
+};
+} // namespace sen
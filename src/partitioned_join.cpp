@@ -0,0 +1,221 @@
+#include "partitioned_join.h"
+#include "rule_set.h"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <string_view>
+#include <unordered_map>
+
+namespace sen {
+namespace {
+// Binding rows are stored flat with one slot per rule variable, nullptr while unbound.
+// Slots point into facts of the view, or into copies of entities decoded from disk segments.
+using row_set = std::vector<const std::string*>;
+
+// Rounds the facts of the last relation condition are probed and emitted in.
+constexpr size_t emit_rounds = 16;
+
+bool has_attributes(const fact_t& fact, const std::vector<actions::attribute_t>& attributes) {
+    return std::all_of(attributes.begin(), attributes.end(), [&](const auto& attr) {
+        return std::find(fact.attributes.begin(), fact.attributes.end(), attr) != fact.attributes.end();
+    });
+}
+} // namespace
+
+bool partitioned_join(const fact_view& view, const actions::rule_t& rule, worker_pool& pool,
+                      const std::function<bool()>& interrupted,
+                      const std::function<bool(const actions::relation_t&)>& emit) {
+    if (rule.conditions.empty() || !rule_set::predicates_bound(rule)) return true;
+    const size_t partitions = pool.size();
+
+    std::map<std::string, size_t> slots;
+    auto slot_of = [&](const std::string& var) { return slots.emplace(var, slots.size()).first->second; };
+    for (const auto& condition : rule.conditions) {
+        if (const auto* rel = std::get_if<actions::relation_t>(&condition.value)) {
+            slot_of(rel->var1);
+            slot_of(rel->var2);
+        } else if (const auto* pred = std::get_if<actions::predicate_t>(&condition.value)) {
+            slot_of(pred->var);
+        }
+    }
+    const size_t from_slot = slot_of(rule.conclusion.var1);
+    const size_t to_slot = slot_of(rule.conclusion.var2);
+    const size_t stride = slots.size();
+
+    std::vector<bool> bound(stride, false);
+    std::vector<bool> applied(rule.conditions.size(), false);
+    // rows stay in the shard of the worker that produced them, they are never gathered
+    std::vector<row_set> rows(partitions);
+    rows[0].assign(stride, nullptr);
+    std::hash<std::string_view> hasher;
+    std::atomic<bool> stop{false};
+    // facts decoded from disk segments are transient, so rows keep copies of the entities they
+    // bind; every worker appends to its own deque, whose elements never move
+    const bool transient = view.spilled();
+    std::vector<std::deque<std::string>> strings(partitions);
+
+    // polled every 256 steps by every loop, like the scans
+    auto poll = [&](size_t step) {
+        if ((step & 0xff) == 0 && (stop || interrupted())) stop = true;
+        return !stop;
+    };
+    // returns false once emit asked to stop or the limits interrupted emitting
+    auto conclude = [&](const std::vector<row_set>& shards) {
+        size_t step = 0;
+        for (const auto& shard : shards) {
+            for (size_t r = 0; r < shard.size(); r += stride) {
+                if (!poll(++step)) return false;
+                const auto* row = &shard[r];
+                if (!row[from_slot] || !row[to_slot]) {
+                    std::cout << "      Skipped relation due to empty vars: " << rule.conclusion.relation_name << "\n";
+                    continue;
+                }
+                if (!emit({*row[from_slot], rule.conclusion.relation_name, *row[to_slot], rule.conclusion.attributes})) {
+                    stop = true;
+                    return false;
+                }
+            }
+        }
+        return true;
+    };
+
+    size_t last_relation = 0;
+    for (size_t c = 0; c < rule.conditions.size(); ++c) {
+        if (std::holds_alternative<actions::relation_t>(rule.conditions[c].value)) last_relation = c;
+    }
+
+    for (size_t c = 0; c < rule.conditions.size(); ++c) {
+        const auto* cond = std::get_if<actions::relation_t>(&rule.conditions[c].value);
+        if (!cond) continue;
+        const size_t s1 = slots.at(cond->var1);
+        const size_t s2 = slots.at(cond->var2);
+
+        // predicates that can be checked as soon as this condition has bound its variables
+        std::vector<std::pair<size_t, const actions::predicate_t*>> filters;
+        for (size_t k = 0; k < rule.conditions.size(); ++k) {
+            const auto* pred = std::get_if<actions::predicate_t>(&rule.conditions[k].value);
+            if (!pred || applied[k]) continue;
+            size_t slot = slots.at(pred->var);
+            if (bound[slot] || slot == s1 || slot == s2) {
+                filters.emplace_back(slot, pred);
+                applied[k] = true;
+            }
+        }
+
+        auto accept = [&](size_t p, row_set& target, const std::string* const* row, const fact_t& fact) {
+            if (bound[s1] && *row[s1] != fact.var1) return;
+            if (bound[s2] && *row[s2] != fact.var2) return;
+            if (s1 == s2 && fact.var1 != fact.var2) return;
+            for (const auto& [slot, pred] : filters) {
+                const std::string& entity = slot == s1 ? fact.var1 : slot == s2 ? fact.var2 : *row[slot];
+                // looked up per entity like the other matchers, so the cost does not grow with
+                // the predicate store and spilled predicates stay on disk
+                if (!view.snapshot.has_predicate(entity, pred->key, pred->value)) return;
+            }
+            size_t base = target.size();
+            target.insert(target.end(), row, row + stride);
+            target[base + s1] = transient ? &strings[p].emplace_back(fact.var1) : &fact.var1;
+            if (s2 != s1) target[base + s2] = transient ? &strings[p].emplace_back(fact.var2) : &fact.var2;
+        };
+
+        // The last relation condition yields the conclusions. Its facts are probed in rounds
+        // whose rows are emitted right away, so a stopping sink or an exhausted budget ends the
+        // join after at most one more round instead of after the complete join.
+        const bool last = c == last_relation;
+        const size_t rounds = last ? emit_rounds : 1;
+
+        // every worker scans its own share of the relation, facts are streamed from the
+        // segments and never collected
+        std::vector<row_set> next(partitions);
+        std::vector<size_t> shard_facts(partitions, 0);
+        auto scan = [&](size_t p, size_t round, const auto& visit) {
+            size_t probes = 0;
+            view.for_each_fact(cond->relation_name, round * partitions + p, rounds * partitions, [&](const fact_t& fact) {
+                if (!poll(++probes)) return false;
+                if (!has_attributes(fact, cond->attributes)) return true;
+                shard_facts[p]++;
+                visit(fact);
+                return true;
+            });
+        };
+        std::function<void(size_t, size_t)> probe;
+        using row_ref = const std::string* const*;
+        std::vector<std::unordered_multimap<std::string_view, row_ref>> tables(partitions);
+        const bool key_first = bound[s1];
+        if (bound[s1] || bound[s2]) {
+            // rows are shuffled by the hash of the join key into one hash table per worker,
+            // then every fact probes the table its key hashes to
+            const size_t key_slot = key_first ? s1 : s2;
+            std::vector<std::vector<std::vector<row_ref>>> outbox(partitions,
+                                                                  std::vector<std::vector<row_ref>>(partitions));
+            pool.run([&](size_t p) {
+                for (size_t r = 0; r < rows[p].size() && poll(r / stride + 1); r += stride) {
+                    row_ref row = &rows[p][r];
+                    outbox[p][hasher(*row[key_slot]) % partitions].push_back(row);
+                }
+            });
+            if (stop) return false;
+            pool.run([&](size_t p) {
+                size_t step = 0;
+                for (const auto& sender : outbox) {
+                    for (row_ref row : sender[p]) {
+                        if (!poll(++step)) return;
+                        tables[p].emplace(*row[key_slot], row);
+                    }
+                }
+            });
+            if (stop) return false;
+            probe = [&](size_t p, size_t round) {
+                scan(p, round, [&](const fact_t& fact) {
+                    const std::string& key = key_first ? fact.var1 : fact.var2;
+                    const auto& table = tables[hasher(key) % partitions];
+                    auto range = table.equal_range(key);
+                    for (auto it = range.first; it != range.second; ++it) {
+                        accept(p, next[p], it->second, fact);
+                    }
+                });
+            };
+        } else {
+            // nothing to join on yet, every fact is joined with every row
+            probe = [&](size_t p, size_t round) {
+                scan(p, round, [&](const fact_t& fact) {
+                    size_t step = 0;
+                    for (const auto& shard : rows) {
+                        for (size_t r = 0; r < shard.size() && poll(++step); r += stride) {
+                            accept(p, next[p], &shard[r], fact);
+                        }
+                    }
+                });
+            };
+        }
+
+        size_t next_count = 0;
+        for (size_t round = 0; round < rounds && !stop; ++round) {
+            pool.run([&](size_t p) { probe(p, round); });
+            for (const auto& shard : next) next_count += shard.size() / stride;
+            if (last && !stop) {
+                if (!conclude(next)) break;
+                for (auto& shard : next) shard.clear();
+            }
+            // rounds with fewer than 256 facts or rows never reach a poll of their own
+            if (!stop && interrupted()) stop = true;
+        }
+        bound[s1] = bound[s2] = true;
+
+        size_t row_count = 0, fact_count = 0;
+        for (size_t p = 0; p < partitions; ++p) {
+            row_count += rows[p].size() / stride;
+            fact_count += shard_facts[p];
+        }
+        std::cout << "      Partitioned join on " << cond->relation_name << " (" << partitions << " partitions): "
+                  << row_count << " rows x " << fact_count << " facts -> " << next_count << " rows\n";
+        if (stop) return false;
+        if (last) return true;
+        rows.swap(next);
+        if (next_count == 0) return true;
+    }
+    return true;
+}
+} // namespace sen
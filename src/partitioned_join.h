@@ -0,0 +1,22 @@
+#pragma once
+
+#include "fact_store.h"
+#include "worker_pool.h"
+#include <functional>
+
+namespace sen {
+// Evaluates the conditions of a rule as a hash join spread over the workers of `pool`.
+// For every relation condition, the binding rows are shuffled by a hash of the join-key entity
+// into one hash table per worker. Every worker then streams its share of the candidate facts
+// from the segments and probes the table each fact's key hashes to, so relations joined against
+// bound rows are never loaded into memory as a whole. The binding rows themselves are held in
+// memory: the first relation condition has nothing to join on, so each of its matching facts
+// becomes a row, with copies of its entities if they were read from disk segments.
+// Predicates are applied as filters as soon as their variable is bound. Conclusions are passed
+// to emit on the calling thread in rounds while the last relation condition is probed, returning
+// false stops the join. Every phase polls interrupted, after which the join returns false.
+// Computes the same join as the nested-loop matcher.
+bool partitioned_join(const fact_view& view, const actions::rule_t& rule, worker_pool& pool,
+                      const std::function<bool()>& interrupted,
+                      const std::function<bool(const actions::relation_t&)>& emit);
+} // namespace sen
@@ -0,0 +1,290 @@
+#include "relation_graph.h"
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <unordered_set>
+
+namespace sen {
+namespace {
+// Frontiers smaller than this are expanded on the calling thread.
+constexpr size_t parallel_frontier = 1024;
+
+struct edge {
+    uint32_t source;
+    uint32_t target;
+    uint32_t attributes;
+};
+
+std::string attribute_key(std::vector<actions::attribute_t> attributes) {
+    std::sort(attributes.begin(), attributes.end(),
+              [](const auto& a, const auto& b) { return std::tie(a.key, a.value) < std::tie(b.key, b.value); });
+    std::string key;
+    for (const auto& attr : attributes) {
+        key += attr.key + '\x1e' + attr.value + '\x1f';
+    }
+    return key;
+}
+
+void fill(adjacency_run::direction& dir, std::vector<edge>& edges) {
+    std::sort(edges.begin(), edges.end(),
+              [](const edge& a, const edge& b) { return std::tie(a.source, a.target) < std::tie(b.source, b.target); });
+    dir.targets.reserve(edges.size());
+    dir.edge_attributes.reserve(edges.size());
+    for (size_t i = 0; i < edges.size(); ++i) {
+        if (i == 0 || edges[i].source != edges[i - 1].source) {
+            dir.vertices.push_back(edges[i].source);
+            dir.offsets.push_back(static_cast<uint32_t>(i));
+        }
+        dir.targets.push_back(edges[i].target);
+        dir.edge_attributes.push_back(edges[i].attributes);
+    }
+    dir.offsets.push_back(static_cast<uint32_t>(edges.size()));
+}
+
+template<typename Scan>
+std::shared_ptr<const adjacency_run> build_run(entity_dictionary& entities, Scan&& scan) {
+    auto run = std::make_shared<adjacency_run>();
+    std::vector<edge> edges;
+    std::unordered_map<std::string, uint32_t> attribute_index;
+    scan([&](const fact_t& fact) {
+        auto [it, inserted] = attribute_index.emplace(attribute_key(fact.attributes),
+                                                      static_cast<uint32_t>(run->attribute_sets.size()));
+        if (inserted) run->attribute_sets.push_back(fact.attributes);
+        edges.push_back({entities.intern(fact.var1), entities.intern(fact.var2), it->second});
+        return true;
+    });
+    fill(run->outgoing, edges);
+    for (auto& e : edges) {
+        std::swap(e.source, e.target);
+    }
+    fill(run->incoming, edges);
+    return run;
+}
+} // namespace
+
+uint32_t entity_dictionary::intern(const std::string& name) {
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = ids.find(name);
+    if (it != ids.end()) return it->second;
+    uint32_t id = static_cast<uint32_t>(names.size());
+    ids.emplace(names.emplace_back(name), id);
+    return id;
+}
+
+std::optional<uint32_t> entity_dictionary::find(const std::string& name) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = ids.find(name);
+    if (it == ids.end()) return std::nullopt;
+    return it->second;
+}
+
+std::string entity_dictionary::name(uint32_t id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return names.at(id);
+}
+
+relation_graph::relation_graph(uint64_t version, std::shared_ptr<const entity_dictionary> entities,
+                               std::vector<std::shared_ptr<const adjacency_run>> runs)
+    : snapshot_version(version), entities(std::move(entities)), runs(std::move(runs)) {}
+
+relation_graph::edge_filter relation_graph::make_filter(const traversal_options& options) const {
+    edge_filter filter;
+    for (const auto& run : runs) {
+        auto& allowed = filter.emplace_back();
+        for (const auto& attributes : run->attribute_sets) {
+            allowed.push_back(std::all_of(options.edge_attributes.begin(), options.edge_attributes.end(),
+                                          [&](const auto& attr) {
+                                              return std::find(attributes.begin(), attributes.end(), attr) !=
+                                                     attributes.end();
+                                          }));
+        }
+    }
+    return filter;
+}
+
+template<typename F>
+void relation_graph::for_each_neighbor(uint32_t vertex, const traversal_options& options, const edge_filter& filter,
+                                       F&& f) const {
+    for (size_t r = 0; r < runs.size(); ++r) {
+        for (const auto* dir : {&runs[r]->outgoing, &runs[r]->incoming}) {
+            if (dir == &runs[r]->outgoing && options.direction == traversal_direction::incoming) continue;
+            if (dir == &runs[r]->incoming && options.direction == traversal_direction::outgoing) continue;
+            auto it = std::lower_bound(dir->vertices.begin(), dir->vertices.end(), vertex);
+            if (it == dir->vertices.end() || *it != vertex) continue;
+            size_t row = it - dir->vertices.begin();
+            for (uint32_t k = dir->offsets[row]; k < dir->offsets[row + 1]; ++k) {
+                if (filter[r][dir->edge_attributes[k]]) f(dir->targets[k]);
+            }
+        }
+    }
+}
+
+// Level-synchronous: the frontier of every level is split over the workers, which expand their
+// part through all runs. Reached entities are merged into the visited set on the calling thread.
+template<typename F>
+void relation_graph::search(uint32_t start, const traversal_options& options, worker_pool* pool, F&& visit) const {
+    const auto filter = make_filter(options);
+    std::unordered_set<uint32_t> visited{start};
+    std::vector<uint32_t> frontier{start};
+    for (size_t hops = 1; !frontier.empty() && (options.max_hops == 0 || hops <= options.max_hops); ++hops) {
+        const size_t parts = pool && frontier.size() >= parallel_frontier ? pool->size() : 1;
+        std::vector<std::vector<uint32_t>> reached(parts);
+        auto expand = [&](size_t p) {
+            for (size_t i = frontier.size() * p / parts; i < frontier.size() * (p + 1) / parts; ++i) {
+                for_each_neighbor(frontier[i], options, filter, [&](uint32_t id) {
+                    if (!visited.count(id)) reached[p].push_back(id);
+                });
+            }
+        };
+        if (parts > 1) {
+            pool->run(expand);
+        } else {
+            expand(0);
+        }
+        frontier.clear();
+        for (const auto& part : reached) {
+            for (uint32_t id : part) {
+                if (!visited.insert(id).second) continue;
+                if (!visit(id, hops)) return;
+                frontier.push_back(id);
+            }
+        }
+    }
+}
+
+std::vector<graph_hit> relation_graph::neighborhood(const std::string& entity, const traversal_options& options,
+                                                    worker_pool* pool) const {
+    std::vector<graph_hit> hits;
+    auto start = entities->find(entity);
+    if (!start) return hits;
+    search(*start, options, pool, [&](uint32_t id, size_t hops) {
+        hits.push_back({entities->name(id), hops});
+        return true;
+    });
+    return hits;
+}
+
+bool relation_graph::reachable(const std::string& from, const std::string& to, const traversal_options& options,
+                               worker_pool* pool) const {
+    auto start = entities->find(from);
+    auto goal = entities->find(to);
+    if (!start || !goal) return false;
+    bool found = false;
+    if (*start == *goal) {
+        // the search never revisits its start, so look for an edge back to it from an entity
+        // that leaves a hop to spare
+        const auto filter = make_filter(options);
+        auto closes_cycle = [&](uint32_t id) {
+            bool back = false;
+            for_each_neighbor(id, options, filter, [&](uint32_t next) { back = back || next == *goal; });
+            return back;
+        };
+        if (closes_cycle(*start)) return true;
+        search(*start, options, pool, [&](uint32_t id, size_t hops) {
+            found = (options.max_hops == 0 || hops < options.max_hops) && closes_cycle(id);
+            return !found;
+        });
+        return found;
+    }
+    search(*start, options, pool, [&](uint32_t id, size_t) {
+        found = id == *goal;
+        return !found;
+    });
+    return found;
+}
+
+std::vector<std::vector<std::string>> relation_graph::paths(const std::string& from, const std::string& to,
+                                                            const traversal_options& options) const {
+    std::vector<std::vector<std::string>> result;
+    auto start = entities->find(from);
+    auto goal = entities->find(to);
+    if (!start || !goal) return result;
+    const auto filter = make_filter(options);
+    std::vector<uint32_t> path{*start};
+    std::unordered_set<uint32_t> on_path{*start};
+    // returns false once max_results paths were found
+    std::function<bool()> extend = [&] {
+        if (path.size() > 1 && path.back() == *goal) {
+            auto& named = result.emplace_back();
+            for (uint32_t id : path) {
+                named.push_back(entities->name(id));
+            }
+            return options.max_results == 0 || result.size() < options.max_results;
+        }
+        if (options.max_hops > 0 && path.size() > options.max_hops) return true;
+        // parallel edges and edges repeated in several runs lead to the same path
+        std::vector<uint32_t> next;
+        // the goal is only on the path already when it is the start, reaching it closes a cycle
+        for_each_neighbor(path.back(), options, filter, [&](uint32_t id) {
+            if (!on_path.count(id) || id == *goal) next.push_back(id);
+        });
+        std::sort(next.begin(), next.end());
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        for (uint32_t id : next) {
+            path.push_back(id);
+            on_path.insert(id);
+            bool more = extend();
+            on_path.erase(id);
+            path.pop_back();
+            if (!more) return false;
+        }
+        return true;
+    };
+    extend();
+    return result;
+}
+
+graph_index::graph_index() : entities(std::make_shared<entity_dictionary>()) {}
+
+std::shared_ptr<const relation_graph> graph_index::graph(const fact_snapshot& snapshot, const std::string& relation) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto cached = latest.find(relation);
+        if (cached != latest.end() && !cached->second->stale(snapshot)) return cached->second;
+    }
+    std::vector<std::shared_ptr<const adjacency_run>> result;
+    auto add = [&](std::shared_ptr<const adjacency_run> run) {
+        if (!run->outgoing.targets.empty()) result.push_back(std::move(run));
+    };
+    for (const auto& [type, partition] : snapshot.partitions) {
+        for (const auto& segment : partition.disk_segments) {
+            add(run_for(segment, relation, [&](auto&& f) { segment->for_each_fact(relation, f); }));
+        }
+        for (const auto* list : {&partition.sealed, &partition.segments}) {
+            for (const auto& segment : *list) {
+                add(run_for(segment, relation, [&](auto&& f) { for_each_fact_in(*segment, relation, f); }));
+            }
+        }
+    }
+    auto built = std::make_shared<const relation_graph>(snapshot.version, entities, std::move(result));
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = runs.begin(); it != runs.end();) {
+        it = it->second.first.expired() ? runs.erase(it) : std::next(it);
+    }
+    // a concurrent query may have built the graph of a newer snapshot meanwhile
+    auto& cached = latest[relation];
+    if (!cached || cached->version() < built->version()) cached = built;
+    return built;
+}
+
+template<typename S, typename Scan>
+std::shared_ptr<const adjacency_run> graph_index::run_for(const std::shared_ptr<S>& segment,
+                                                          const std::string& relation, Scan&& scan) {
+    auto key = std::make_pair(static_cast<const void*>(segment.get()), relation);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = runs.find(key);
+        if (it != runs.end() && !it->second.first.expired()) return it->second.second;
+    }
+    // built outside the lock, concurrent queries may index the same segment twice
+    auto run = build_run(*entities, scan);
+    std::lock_guard<std::mutex> lock(mutex);
+    runs[key] = {std::weak_ptr<const void>(segment), run};
+    return run;
+}
+} // namespace sen
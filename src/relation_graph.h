@@ -0,0 +1,126 @@
+#pragma once
+
+#include "fact_store.h"
+#include "worker_pool.h"
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace sen {
+// Entity names interned to dense ids, shared by every graph of an index. Ids are never reused.
+class entity_dictionary {
+public:
+    uint32_t intern(const std::string& name);
+    std::optional<uint32_t> find(const std::string& name) const;
+    std::string name(uint32_t id) const;
+
+private:
+    mutable std::shared_mutex mutex;
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, uint32_t> ids;
+};
+
+// Compressed sparse row adjacency of one relation within one immutable segment, in both
+// directions. Only entities with edges get a row, found by binary search over `vertices`.
+struct adjacency_run {
+    struct direction {
+        std::vector<uint32_t> vertices;          // sorted entity ids
+        std::vector<uint32_t> offsets;           // vertices.size() + 1 offsets into targets
+        std::vector<uint32_t> targets;
+        std::vector<uint32_t> edge_attributes;   // index into attribute_sets for every target
+    };
+    direction outgoing;
+    direction incoming;
+    std::vector<std::vector<actions::attribute_t>> attribute_sets;
+};
+
+enum class traversal_direction { outgoing, incoming, both };
+
+struct traversal_options {
+    size_t max_hops = 1;   // 0 = unlimited
+    traversal_direction direction = traversal_direction::outgoing;
+    std::vector<actions::attribute_t> edge_attributes;   // edges must carry all of them
+    size_t max_results = 0;   // paths only, 0 = unlimited
+};
+
+struct graph_hit {
+    std::string entity;
+    size_t hops;
+};
+
+// The adjacency of one relation in one snapshot, made of one run per segment holding facts of
+// the relation. Immutable, so queries can run concurrently with ingest.
+class relation_graph {
+public:
+    relation_graph(uint64_t version, std::shared_ptr<const entity_dictionary> entities,
+                   std::vector<std::shared_ptr<const adjacency_run>> runs);
+
+    // Version of the snapshot the graph was built from. It is stale, and may be out of date,
+    // once the fact store's current version is newer, whatever that version changed.
+    uint64_t version() const { return snapshot_version; }
+    bool stale(const fact_snapshot& latest) const { return latest.version != snapshot_version; }
+
+    // Entities within max_hops of entity in breadth-first order, excluding entity itself.
+    // Every level's frontier is expanded in parallel on the pool's workers if one is given.
+    std::vector<graph_hit> neighborhood(const std::string& entity, const traversal_options& options,
+                                        worker_pool* pool = nullptr) const;
+    // An entity reaches itself if it lies on a cycle of at most max_hops edges, like paths().
+    // With direction both, an edge followed there and back counts as such a cycle.
+    bool reachable(const std::string& from, const std::string& to, const traversal_options& options,
+                   worker_pool* pool = nullptr) const;
+    // Simple paths from `from` to `to` with at most max_hops edges, depth first on the calling
+    // thread. Each path lists its entities including both ends; for from == to these are the
+    // cycles through it.
+    std::vector<std::vector<std::string>> paths(const std::string& from, const std::string& to,
+                                                const traversal_options& options) const;
+
+private:
+    uint64_t snapshot_version;
+    std::shared_ptr<const entity_dictionary> entities;
+    std::vector<std::shared_ptr<const adjacency_run>> runs;
+
+    // Per run, whether each attribute set satisfies the options' edge_attributes.
+    using edge_filter = std::vector<std::vector<bool>>;
+    edge_filter make_filter(const traversal_options& options) const;
+    template<typename F>
+    void for_each_neighbor(uint32_t vertex, const traversal_options& options, const edge_filter& filter,
+                           F&& f) const;
+    // Breadth-first search calling visit(id, hops) for every newly reached entity until it
+    // returns false.
+    template<typename F>
+    void search(uint32_t start, const traversal_options& options, worker_pool* pool, F&& visit) const;
+};
+
+// Builds and caches adjacency runs per segment. Segments are immutable, so after ingest only
+// segments created since the previous query are indexed; runs of segments that are no longer
+// referenced by any snapshot are dropped. The last graph of each relation is returned again
+// until the snapshot it was built from is stale.
+// Adjacency is held in memory, about 16 bytes per edge, also for facts in mapped segments.
+class graph_index {
+public:
+    graph_index();
+
+    std::shared_ptr<const relation_graph> graph(const fact_snapshot& snapshot, const std::string& relation);
+
+private:
+    std::shared_ptr<entity_dictionary> entities;
+    std::mutex mutex;
+    // keyed by segment address, the weak reference tells a live segment from a reused address
+    std::map<std::pair<const void*, std::string>,
+             std::pair<std::weak_ptr<const void>, std::shared_ptr<const adjacency_run>>> runs;
+    std::map<std::string, std::shared_ptr<const relation_graph>> latest;
+
+    template<typename S, typename Scan>
+    std::shared_ptr<const adjacency_run> run_for(const std::shared_ptr<S>& segment, const std::string& relation,
+                                                 Scan&& scan);
+};
+} // namespace sen
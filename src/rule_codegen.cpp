@@ -0,0 +1,182 @@
+#include "rule_codegen.h"
+#include "compiled_rules.h"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace sen {
+namespace {
+std::string literal(const std::string& value) {
+    std::string out = "\"";
+    for (unsigned char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            char escaped[5];
+            std::snprintf(escaped, sizeof(escaped), "\\%03o", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out + "\"";
+}
+
+std::string attribute_list(const std::vector<actions::attribute_t>& attributes) {
+    std::string out = "{";
+    for (size_t i = 0; i < attributes.size(); ++i) {
+        if (i > 0) out += ", ";
+        out += "{" + literal(attributes[i].key) + ", " + literal(attributes[i].value) + "}";
+    }
+    return out + "}";
+}
+
+// A predicate before the relation binding its variable, or a conclusion variable that no
+// relation binds, never matches in the interpreter either.
+bool can_match(const actions::rule_t& rule) {
+    auto bound = [&](const std::string& var) {
+        return std::any_of(rule.conditions.begin(), rule.conditions.end(), [&](const auto& condition) {
+            const auto* rel = std::get_if<actions::relation_t>(&condition.value);
+            return rel && (rel->var1 == var || rel->var2 == var);
+        });
+    };
+    return rule_set::predicates_bound(rule) && bound(rule.conclusion.var1) && bound(rule.conclusion.var2);
+}
+
+// Writes the body of a rule that can match. Conditions are matched in declaration order like
+// the interpreter does, every relation condition opens a nested scan over its relation, or
+// over the facts of its first entity once that is bound.
+void generate_body(std::ostream& out, const actions::rule_t& rule) {
+    std::map<std::string, size_t> slots;
+    std::vector<std::string> relations;
+    auto relation_index = [&](const std::string& name) {
+        auto it = std::find(relations.begin(), relations.end(), name);
+        if (it != relations.end()) return static_cast<size_t>(it - relations.begin());
+        relations.push_back(name);
+        return relations.size() - 1;
+    };
+    for (const auto& condition : rule.conditions) {
+        if (const auto* rel = std::get_if<actions::relation_t>(&condition.value)) {
+            slots.emplace(rel->var1, slots.size());
+            slots.emplace(rel->var2, slots.size());
+            relation_index(rel->relation_name);
+        }
+    }
+    relation_index(rule.conclusion.relation_name);
+    // keys and values of the predicates, in condition order
+    std::vector<std::string> predicate_strings;
+    for (const auto& condition : rule.conditions) {
+        if (const auto* pred = std::get_if<actions::predicate_t>(&condition.value)) {
+            predicate_strings.push_back(pred->key);
+            predicate_strings.push_back(pred->value);
+        }
+    }
+
+    out << "    static const std::string relations[] = {";
+    for (size_t i = 0; i < relations.size(); ++i) {
+        out << (i > 0 ? ", " : "") << literal(relations[i]);
+    }
+    out << "};\n";
+    if (!predicate_strings.empty()) {
+        out << "    static const std::string predicates[] = {";
+        for (size_t i = 0; i < predicate_strings.size(); ++i) {
+            out << (i > 0 ? ", " : "") << literal(predicate_strings[i]);
+        }
+        out << "};\n";
+    }
+    out << "    static const std::vector<sen::actions::attribute_t> conclusion_attributes = "
+        << attribute_list(rule.conclusion.attributes) << ";\n";
+    out << "    constexpr size_t ";
+    size_t n = 0;
+    for (const auto& [var, slot] : slots) {
+        out << (n++ > 0 ? ", " : "") << "var_" << var << " = " << slot;
+    }
+    out << ";\n";
+    out << "    const std::string* slots[" << slots.size() << "] = {};\n";
+    out << "    size_t steps = 0;\n";
+
+    std::set<std::string> bound;
+    std::string indent = "    ";
+    size_t depth = 0;
+    size_t predicate = 0;
+    for (const auto& condition : rule.conditions) {
+        if (const auto* pred = std::get_if<actions::predicate_t>(&condition.value)) {
+            out << indent << "if (!sen::has_predicate(view.snapshot, *slots[var_" << pred->var << "], predicates["
+                << predicate << "], predicates[" << predicate + 1 << "])) return true;\n";
+            predicate += 2;
+            continue;
+        }
+        const auto& rel = std::get<actions::relation_t>(condition.value);
+        const std::string fact = "f" + std::to_string(depth++);
+        // a bound first entity is looked up instead of scanning the whole relation
+        const bool lookup = bound.count(rel.var1) > 0;
+        out << indent << "return view.for_each_fact(relations[" << relation_index(rel.relation_name) << "], ";
+        if (lookup) out << "*slots[var_" << rel.var1 << "], ";
+        out << "[&](const sen::fact_t& " << fact << ") {\n";
+        indent += "    ";
+        out << indent << "if ((++steps & 0xff) == 0 && interrupted()) return false;\n";
+        if (rel.var1 == rel.var2) {
+            out << indent << "if (" << fact << ".var1 != " << fact << ".var2) return true;\n";
+        }
+        for (const auto& [var, side] : {std::make_pair(rel.var1, ".var1"), std::make_pair(rel.var2, ".var2")}) {
+            if (bound.count(var) && !(lookup && var == rel.var1)) {
+                out << indent << "if (" << fact << side << " != *slots[var_" << var << "]) return true;\n";
+            }
+        }
+        for (const auto& attr : rel.attributes) {
+            out << indent << "if (!sen::has_attribute(" << fact << ", " << literal(attr.key) << ", "
+                << literal(attr.value) << ")) return true;\n";
+        }
+        for (const auto& [var, side] : {std::make_pair(rel.var1, ".var1"), std::make_pair(rel.var2, ".var2")}) {
+            if (bound.insert(var).second) {
+                out << indent << "slots[var_" << var << "] = &" << fact << side << ";\n";
+            }
+        }
+    }
+    out << indent << "return emit({*slots[var_" << rule.conclusion.var1 << "], relations["
+        << relation_index(rule.conclusion.relation_name) << "], *slots[var_" << rule.conclusion.var2
+        << "], conclusion_attributes});\n";
+    while (depth-- > 0) {
+        indent.resize(indent.size() - 4);
+        out << indent << "});\n";
+    }
+}
+} // namespace
+
+std::string generate_rules(const rule_set& rules, const std::string& source_name) {
+    std::ostringstream out;
+    out << "// Generated by sen-rulegen from " << source_name << ", do not edit.\n"
+        << "#include \"compiled_rules.h\"\n\n"
+        << "namespace {\n";
+    std::vector<std::pair<std::string, std::string>> registrations;
+    const auto& contexts = rules.contexts();
+    for (size_t c = 0; c < contexts.size(); ++c) {
+        for (size_t r = 0; r < contexts[c].rules.size(); ++r) {
+            const auto& rule = contexts[c].rules[r];
+            const std::string function = "rule_" + std::to_string(c) + "_" + std::to_string(r);
+            out << "// CONTEXT " << contexts[c].mime_type << " RULE " << rule.name << "\n";
+            if (can_match(rule)) {
+                out << "bool " << function << "(const sen::fact_view& view, const std::function<bool()>& interrupted,\n"
+                    << "        const std::function<bool(const sen::actions::relation_t&)>& emit) {\n";
+                generate_body(out, rule);
+            } else {
+                out << "bool " << function << "(const sen::fact_view&, const std::function<bool()>&,\n"
+                    << "        const std::function<bool(const sen::actions::relation_t&)>&) {\n"
+                    << "    return true;   // never matches\n";
+            }
+            out << "}\n\n";
+            registrations.emplace_back(rule_signature(contexts[c].mime_type, rule), function);
+        }
+    }
+    out << "const sen::compiled_rule_registrar registrars[] = {\n";
+    for (const auto& [signature, function] : registrations) {
+        out << "    {" << literal(signature) << ", &" << function << "},\n";
+    }
+    out << "};\n"
+        << "} // namespace\n";
+    return out.str();
+}
+} // namespace sen
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "rule_set.h"
+#include <string>
+
+namespace sen {
+// Emits a C++ source with one specialized function per rule of the set, registered through
+// compiled_rule_registrar. Each rule becomes nested scans in declaration order with its
+// relation names and attribute constants inlined and its variables in fixed slots.
+std::string generate_rules(const rule_set& rules, const std::string& source_name);
+} // namespace sen
@@ -0,0 +1,159 @@
+#include "rule_set.h"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <tuple>
+
+namespace sen {
+rule_set::rule_set(std::map<std::string, std::string> aliases, std::vector<actions::context_t> contexts)
+    : alias_map(std::move(aliases)), context_list(std::move(contexts)) {
+    for (auto& ctx : context_list) {
+        for (auto& rule : ctx.rules) {
+            for (auto& condition : rule.conditions) {
+                if (auto* rel = std::get_if<actions::relation_t>(&condition.value)) {
+                    rel->relation_name = resolve_alias(rel->relation_name);
+                }
+            }
+            rule.conclusion.relation_name = resolve_alias(rule.conclusion.relation_name);
+        }
+    }
+    build_strata();
+}
+
+// Tarjan's algorithm over the graph with an edge from every rule to each rule reading its
+// conclusion. Components are emitted consumers first, so the result is reversed at the end.
+void rule_set::build_strata() {
+    std::vector<rule_node> nodes;
+    for (size_t c = 0; c < context_list.size(); ++c) {
+        for (size_t r = 0; r < context_list[c].rules.size(); ++r) {
+            const auto& rule = context_list[c].rules[r];
+            rule_node node{c, r, {}, rule.conclusion.relation_name,
+                           find_compiled_rule(rule_signature(context_list[c].mime_type, rule))};
+            for (const auto& condition : rule.conditions) {
+                if (const auto* rel = std::get_if<actions::relation_t>(&condition.value)) {
+                    node.inputs.insert(rel->relation_name);
+                }
+            }
+            nodes.push_back(std::move(node));
+        }
+    }
+    std::vector<std::vector<size_t>> edges(nodes.size());
+    for (size_t from = 0; from < nodes.size(); ++from) {
+        for (size_t to = 0; to < nodes.size(); ++to) {
+            if (nodes[to].inputs.count(nodes[from].output)) edges[from].push_back(to);
+        }
+    }
+
+    std::vector<int> index(nodes.size(), -1), lowlink(nodes.size(), 0);
+    std::vector<bool> on_stack(nodes.size(), false);
+    std::vector<size_t> stack;
+    int next_index = 0;
+    std::function<void(size_t)> connect = [&](size_t v) {
+        index[v] = lowlink[v] = next_index++;
+        stack.push_back(v);
+        on_stack[v] = true;
+        for (size_t w : edges[v]) {
+            if (index[w] < 0) {
+                connect(w);
+                lowlink[v] = std::min(lowlink[v], lowlink[w]);
+            } else if (on_stack[w]) {
+                lowlink[v] = std::min(lowlink[v], index[w]);
+            }
+        }
+        if (lowlink[v] != index[v]) return;
+        stratum component;
+        size_t w;
+        do {
+            w = stack.back();
+            stack.pop_back();
+            on_stack[w] = false;
+            component.rules.push_back(nodes[w]);
+        } while (w != v);
+        // keep declaration order inside a stratum
+        std::sort(component.rules.begin(), component.rules.end(), [](const auto& a, const auto& b) {
+            return std::tie(a.context, a.rule) < std::tie(b.context, b.rule);
+        });
+        component.recursive = component.rules.size() > 1 ||
+                              std::find(edges[v].begin(), edges[v].end(), v) != edges[v].end();
+        strata_list.push_back(std::move(component));
+    };
+    for (size_t v = 0; v < nodes.size(); ++v) {
+        if (index[v] < 0) connect(v);
+    }
+    std::reverse(strata_list.begin(), strata_list.end());
+}
+
+std::shared_ptr<const rule_set> rule_set::parse(const std::string& dsl) {
+    tao::pegtl::string_input<> input(dsl, "rules");
+    actions::rule_state state;
+    bool complete;
+    try {
+        complete = tao::pegtl::parse<grammar::grammar, actions::action>(input, state);
+    } catch (const tao::pegtl::parse_error& e) {
+        std::cerr << "Parse error: " << e.what() << "\n";
+        std::cerr << "At position: " << e.positions()[0].byte << "\n";
+        throw;
+    }
+    // the grammar ends in eof, so input it cannot match fails the parse instead of being ignored
+    if (!complete) {
+        std::cerr << "Parse error: DSL does not match the grammar after " << state.contexts.size()
+                  << " contexts\n";
+        throw std::runtime_error("Invalid rule DSL");
+    }
+    std::cout << "Parsed DSL successfully. Contexts: " << state.contexts.size() << "\n";
+    for (const auto& ctx : state.contexts) {
+        std::cout << "  Context: " << ctx.mime_type << ", Rules: " << ctx.rules.size() << "\n";
+        for (const auto& rule : ctx.rules) {
+            std::cout << "    Rule: " << rule.name << ", Conditions: " << rule.conditions.size()
+                      << ", Conclusion: " << rule.conclusion.relation_name << "\n";
+        }
+    }
+    for (const auto& [alias, rel] : state.aliases) {
+        std::cout << "  Alias: " << alias << " -> " << rel << "\n";
+    }
+    auto rules = std::make_shared<const rule_set>(std::move(state.aliases), std::move(state.contexts));
+    for (size_t i = 0; i < rules->strata().size(); ++i) {
+        const auto& stratum = rules->strata()[i];
+        std::cout << "  Stratum " << i << (stratum.recursive ? " (recursive):" : ":");
+        for (const auto& node : stratum.rules) {
+            std::cout << " " << rules->rule(node).name << (node.compiled ? " (compiled)" : "");
+        }
+        std::cout << "\n";
+    }
+    return rules;
+}
+
+bool rule_set::matches_context(const std::string& rule_context, const std::string& query_context) {
+    if (query_context == "*/*" || rule_context == "*/*") return true;
+    auto split = [](const std::string& s) {
+        auto pos = s.find('/');
+        return std::make_pair(s.substr(0, pos), pos == std::string::npos ? "" : s.substr(pos + 1));
+    };
+    auto [rule_type, rule_subtype] = split(rule_context);
+    auto [query_type, query_subtype] = split(query_context);
+
+    return (rule_type == query_type || rule_type == "*" || query_type == "*") &&
+           (rule_subtype == query_subtype || rule_subtype == "*" || query_subtype == "*");
+}
+
+bool rule_set::predicates_bound(const actions::rule_t& rule) {
+    std::set<std::string> bound;
+    for (const auto& condition : rule.conditions) {
+        if (const auto* rel = std::get_if<actions::relation_t>(&condition.value)) {
+            bound.insert(rel->var1);
+            bound.insert(rel->var2);
+        } else if (!bound.count(std::get<actions::predicate_t>(condition.value).var)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string rule_set::resolve_alias(const std::string& relation) const {
+    auto it = alias_map.find(relation);
+    std::string resolved = it != alias_map.end() ? it->second : relation;
+    std::cout << "      Resolving alias: " << relation << " -> " << resolved << "\n";
+    return resolved;
+}
+} // namespace sen
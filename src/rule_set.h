@@ -0,0 +1,59 @@
+#pragma once
+
+#include "sen_grammar.h"
+#include "compiled_rules.h"
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace sen {
+// Parsed and compiled rules of one DSL source.
+// A rule_set is immutable once built, so a single instance can be shared by any number of
+// engines and threads. Aliases are resolved into the rules at construction time, and rules are
+// ordered into strata along the dependency graph from conclusions to conditions.
+class rule_set {
+public:
+    struct rule_node {
+        size_t context;
+        size_t rule;
+        std::set<std::string> inputs;   // relations read by the rule's conditions
+        std::string output;             // relation written by the rule's conclusion
+        compiled_rule compiled = nullptr;   // specialized code generated by sen-rulegen, if linked in
+    };
+
+    // A strongly connected component of the rule dependency graph. Strata are topologically
+    // sorted, so every rule only depends on rules of its own or an earlier stratum.
+    struct stratum {
+        std::vector<rule_node> rules;
+        bool recursive = false;
+    };
+
+    rule_set() = default;
+    rule_set(std::map<std::string, std::string> aliases, std::vector<actions::context_t> contexts);
+
+    // Throws std::runtime_error if the DSL does not match the grammar as a whole.
+    static std::shared_ptr<const rule_set> parse(const std::string& dsl);
+
+    const std::map<std::string, std::string>& aliases() const { return alias_map; }
+    const std::vector<actions::context_t>& contexts() const { return context_list; }
+    const std::vector<stratum>& strata() const { return strata_list; }
+    const actions::rule_t& rule(const rule_node& node) const { return context_list[node.context].rules[node.rule]; }
+    const std::string& context_of(const rule_node& node) const { return context_list[node.context].mime_type; }
+    std::string resolve_alias(const std::string& relation) const;
+
+    // MIME type match where "*" on either side matches any type or subtype.
+    static bool matches_context(const std::string& rule_context, const std::string& query_context);
+    // Whether every predicate follows a relation condition binding its variable. Like the
+    // interpreter, every matcher treats a rule with any other predicate as never matching.
+    static bool predicates_bound(const actions::rule_t& rule);
+
+private:
+    std::map<std::string, std::string> alias_map;
+    std::vector<actions::context_t> context_list;
+    std::vector<stratum> strata_list;
+
+    void build_strata();
+};
+} // namespace sen
@@ -0,0 +1,37 @@
+// rulegen.cpp
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "rule_codegen.h"
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: sen-rulegen <rules.sen> <output.cpp>\n";
+        return 1;
+    }
+    std::ifstream in(argv[1]);
+    if (!in) {
+        std::cerr << "Cannot read " << argv[1] << "\n";
+        return 1;
+    }
+    std::stringstream dsl;
+    dsl << in.rdbuf();
+
+    std::shared_ptr<const sen::rule_set> rules;
+    try {
+        rules = sen::rule_set::parse(dsl.str());
+    } catch (const std::exception& e) {
+        std::cerr << "Cannot compile " << argv[1] << ": " << e.what() << "\n";
+        return 1;
+    }
+
+    std::ofstream out(argv[2]);
+    out << sen::generate_rules(*rules, argv[1]);
+    out.close();
+    if (!out) {
+        std::cerr << "Cannot write " << argv[2] << "\n";
+        return 1;
+    }
+    std::cout << "Generated compiled rules into " << argv[2] << "\n";
+    return 0;
+}
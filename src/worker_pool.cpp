@@ -0,0 +1,55 @@
+#include "worker_pool.h"
+
+namespace sen {
+worker_pool::worker_pool(size_t threads) {
+    workers.reserve(threads);
+    for (size_t p = 0; p < threads; ++p) {
+        workers.emplace_back(&worker_pool::work, this, p);
+    }
+}
+
+worker_pool::~worker_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+void worker_pool::run(const std::function<void(size_t)>& fn) {
+    std::lock_guard<std::mutex> serialize(run_mutex);
+    std::unique_lock<std::mutex> lock(mutex);
+    task = &fn;
+    pending = workers.size();
+    error = nullptr;
+    generation++;
+    work_ready.notify_all();
+    work_done.wait(lock, [this] { return pending == 0; });
+    task = nullptr;
+    if (error) std::rethrow_exception(error);
+}
+
+void worker_pool::work(size_t p) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_ready.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        const auto* fn = task;
+        lock.unlock();
+        std::exception_ptr failure;
+        try {
+            (*fn)(p);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        lock.lock();
+        if (failure && !error) error = failure;
+        if (--pending == 0) work_done.notify_one();
+    }
+}
+} // namespace sen
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sen {
+// A fixed set of threads that is kept alive across joins, so parallel phases do not pay for
+// thread creation. Each run hands one task index to every worker.
+class worker_pool {
+public:
+    explicit worker_pool(size_t threads);
+    ~worker_pool();
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    // Calls fn(p) for every p in [0, size()) in parallel and returns once all calls finished,
+    // rethrowing the first exception. Runs from several threads are serialized; fn must not
+    // start a run on the same pool.
+    void run(const std::function<void(size_t)>& fn);
+
+private:
+    std::mutex run_mutex;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    const std::function<void(size_t)>* task = nullptr;   // guarded by mutex
+    uint64_t generation = 0;
+    size_t pending = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::vector<std::thread> workers;
+
+    void work(size_t p);
+};
+} // namespace sen
@@ -0,0 +1,220 @@
+// engine_regression.cpp
+// Reproducers of snapshot, publishing and limit bugs, run with the interpreter, the compiled rules
+// and the partitioned join, each in memory and out of core:
+//  - two concurrent inferences over the same facts published every relation twice,
+//  - a run whose last rule was interrupted reported complete,
+//  - runs stopped by a limit published their partial results,
+//  - a budget of exactly the relations a run derives was reported exhausted,
+//  - writers hung for good once the spill directory became unwritable,
+//  - the partitioned join copied every predicate of a checked key into memory on every run.
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include "test_support.h"
+
+namespace {
+using sen_test::variant;
+
+int failures = 0;
+
+void expect(bool ok, const variant& v, const std::string& what) {
+    if (ok) return;
+    failures++;
+    std::cerr << v.name << ": " << what << "\n";
+}
+
+// parent(n0, n1), parent(n1, n2), ... or the same chain of ancestor facts.
+std::unique_ptr<sen::InferenceEngine> chain(const variant& v, const std::string& relation, int length) {
+    auto engine = std::make_unique<sen::InferenceEngine>(v.rules, *v.storage);
+    engine->set_partitions(v.partitions);
+    for (int i = 0; i < length; ++i) engine->add_fact(relation, "n" + std::to_string(i), "n" + std::to_string(i + 1));
+    return engine;
+}
+
+// Each run deduplicated only against its own snapshot, so two overlapping runs stored the 299
+// grandparent relations of a 300 fact chain twice.
+void concurrent_inferences_publish_once(const variant& v) {
+    for (int attempt = 0; attempt < 5; ++attempt) {
+        auto engine = chain(v, "parent", 300);
+        auto first = engine->infer_async("app/chain", 2);
+        auto second = engine->infer_async("app/chain", 2);
+        const auto a = first.get();
+        const auto b = second.get();
+        expect(a.status == sen::infer_status::complete && b.status == sen::infer_status::complete, v,
+               "concurrent inferences did not complete");
+        const size_t stored = engine->snapshot()->fact_count;
+        expect(stored == 300 + 299, v,
+               "concurrent inferences left " + std::to_string(stored) + " facts, expected 599");
+    }
+}
+
+// A cancellation seen only by the matcher of the last rule used to be dropped.
+void interrupted_last_rule_is_reported(const variant& v) {
+    auto engine = chain(v, "parent", 2000);
+    sen::infer_limits limits;
+    const auto status = engine->infer("app/chain", 2, 0, limits, [&](const sen::actions::relation_t&) {
+        limits.cancel.cancel();
+        return true;
+    });
+    expect(status == sen::infer_status::cancelled, v,
+           "cancelled run reported status " + sen::to_string(status));
+    expect(engine->snapshot()->fact_count == 2000, v, "cancelled run published relations");
+}
+
+// Stopped runs return their partial results but leave the store unchanged.
+void stopped_runs_do_not_publish(const variant& v) {
+    {
+        auto engine = chain(v, "ancestor", 400);
+        sen::infer_limits limits;
+        limits.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+        const auto result = engine->infer("app/closure", 2, 0, limits);
+        expect(result.status == sen::infer_status::deadline_exceeded, v,
+               "deadline run reported status " + sen::to_string(result.status));
+        expect(engine->snapshot()->fact_count == 400, v, "deadline run published relations");
+    }
+    {
+        auto engine = chain(v, "ancestor", 400);
+        sen::infer_limits limits;
+        limits.max_relations = 1;
+        const auto result = engine->infer("app/closure", 2, 0, limits);
+        expect(result.status == sen::infer_status::budget_exhausted && result.relations.size() == 1, v,
+               "budget run returned " + std::to_string(result.relations.size()) + " relations with status " +
+                   sen::to_string(result.status));
+        expect(engine->snapshot()->fact_count == 400, v, "budget run published relations");
+    }
+    {
+        auto engine = chain(v, "parent", 300);
+        sen::infer_limits limits;
+        limits.publish = false;
+        const auto result = engine->infer("app/chain", 2, 0, limits);
+        expect(result.status == sen::infer_status::complete && result.relations.size() == 299, v,
+               "unpublished run returned " + std::to_string(result.relations.size()) + " relations");
+        expect(engine->snapshot()->fact_count == 300, v, "run with publish = false published relations");
+        engine->infer("app/chain", 2);
+        expect(engine->snapshot()->fact_count == 300 + 299, v, "completed run did not publish");
+    }
+}
+
+// The budget was checked before every rule, so the fixpoint round that derives nothing new
+// already reported it exhausted. The ancestor closure of a 5 fact chain has 10 new relations.
+void exact_budget_completes(const variant& v) {
+    {
+        auto engine = chain(v, "ancestor", 5);
+        sen::infer_limits limits;
+        limits.max_relations = 10;
+        const auto result = engine->infer("app/closure", 2, 0, limits);
+        expect(result.status == sen::infer_status::complete && result.relations.size() == 10, v,
+               "exact budget run returned " + std::to_string(result.relations.size()) + " relations with status " +
+                   sen::to_string(result.status));
+        expect(engine->snapshot()->fact_count == 5 + 10, v, "exact budget run did not publish");
+    }
+    {
+        auto engine = chain(v, "ancestor", 5);
+        sen::infer_limits limits;
+        limits.max_relations = 9;
+        const auto result = engine->infer("app/closure", 2, 0, limits);
+        expect(result.status == sen::infer_status::budget_exhausted && result.relations.size() == 9, v,
+               "budget run one short returned " + std::to_string(result.relations.size()) + " relations with status " +
+                   sen::to_string(result.status));
+    }
+}
+
+// The join of 10 facts read all 200k predicates into a hash set for every evaluation, so 20
+// inferences took seconds with 4 partitions and milliseconds without; they must take about as
+// long as looking up the predicates of the joined entities.
+void join_with_large_predicate_store(const variant& v) {
+    // the sequential matchers always looked predicates up per entity
+    if (v.partitions == 1) return;
+    auto engine = chain(v, "parent", 10);
+    for (int i = 0; i < 200000; ++i) {
+        engine->add_predicate("m" + std::to_string(i), "color", i % 2 ? "red" : "blue");
+    }
+    for (int i = 1; i <= 10; i += 2) engine->add_predicate("n" + std::to_string(i), "color", "red");
+    sen::infer_limits limits;
+    limits.publish = false;
+    const auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < 20; ++run) {
+        const auto result = engine->infer("app/colors", 2, 0, limits);
+        if (result.relations.size() != 5) {
+            expect(false, v, "large predicate store run returned " + std::to_string(result.relations.size()) +
+                                 " relations, expected 5");
+            return;
+        }
+    }
+    const auto elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    expect(elapsed < std::chrono::seconds(1), v,
+           "20 joins with a large predicate store took " + std::to_string(elapsed.count()) + " ms");
+}
+
+// The compactor retried a failed flush forever and writers waited for it without a timeout.
+// Facts and predicates added before a write failed stay readable.
+int unwritable_spill_directory_fails_writes() {
+    char directory[] = "/tmp/sen-unwritable-XXXXXX";
+    if (!::mkdtemp(directory)) throw std::runtime_error("Cannot create a segment directory");
+    sen::fact_store_options options;
+    options.directory = directory;
+    options.buffer_facts = 4;
+    options.max_buffered_facts = 8;
+    sen::fact_store store(options);
+    ::rmdir(directory);
+
+    int errors = 0;
+    auto fails = [&](const std::string& what, const auto& write) {
+        for (int i = 0; i < 100; ++i) {
+            try {
+                write(i);
+            } catch (const std::runtime_error&) {
+                return;
+            }
+        }
+        errors++;
+        std::cerr << what << " did not fail\n";
+    };
+    size_t facts = 0;
+    fails("adding facts", [&](int i) {
+        store.add_fact({"n" + std::to_string(i), "parent", "n" + std::to_string(i + 1), {}});
+        facts++;
+    });
+    size_t predicates = 0;
+    fails("adding predicates", [&](int i) {
+        store.add_predicate({"n" + std::to_string(i), "color", "red"});
+        predicates++;
+    });
+    size_t stored_predicates = 0;
+    store.snapshot()->for_each_predicate([&](const sen::predicate_t&) {
+        stored_predicates++;
+        return true;
+    });
+    if (store.snapshot()->fact_count != facts || stored_predicates != predicates) {
+        errors++;
+        std::cerr << "failed writes lost facts or predicates\n";
+    }
+    // every failing write queues the flush again, the next one fails after new attempts
+    fails("adding facts again", [&](int i) { store.add_fact({"m" + std::to_string(i), "parent", "m", {}}); });
+    return errors;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: sen-regression-test <rules.sen>\n";
+        return 2;
+    }
+    sen::fact_store_options spill;
+    spill.buffer_facts = 64;
+    spill.max_buffered_facts = 256;
+    spill.max_merge_facts = 1024;
+    sen_test::environment env("regression", spill);
+    for (const auto& v : env.variants(sen_test::strategies(sen_test::parse_file(argv[1]), {4}))) {
+        concurrent_inferences_publish_once(v);
+        interrupted_last_rule_is_reported(v);
+        stopped_runs_do_not_publish(v);
+        exact_budget_completes(v);
+        join_with_large_predicate_store(v);
+    }
+    failures += unwritable_spill_directory_fails_writes();
+    return env.report(failures, "All regression checks passed", "Regression checks failed");
+}
@@ -0,0 +1,293 @@
+// graph_traversal.cpp
+// Compares neighborhood, reachable and paths with a brute force over random graphs, for max_hops
+// 0 to 3, every direction and edge attribute filter, including from == to. Facts are added in
+// batches and every batch is queried, so the adjacency index is rebuilt incrementally; a graph
+// taken after the first batch must keep answering for that batch and be stale after the next
+// one, while an unchanged snapshot reuses its graph. Runs in memory and out of core, sequentially
+// and with 4 workers.
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include "test_support.h"
+
+namespace {
+using sen::actions::attribute_t;
+using sen_test::variant;
+using sen::traversal_direction;
+using sen::traversal_options;
+
+struct edge {
+    size_t from;
+    size_t to;
+    std::vector<attribute_t> attributes;
+};
+
+std::string name_of(size_t vertex) { return "v" + std::to_string(vertex); }
+
+// Answers the traversals from the edges the options allow: hop counts come from the sets of
+// entities reached by walks of exactly k edges, paths are enumerated exhaustively.
+class reference_graph {
+public:
+    reference_graph(size_t vertices, std::vector<edge> edges) : vertices(vertices), edges(std::move(edges)) {}
+
+    std::set<std::pair<std::string, size_t>> neighborhood(size_t start, const traversal_options& options) const {
+        std::set<std::pair<std::string, size_t>> result;
+        std::set<size_t> seen{start};
+        walks(start, options, [&](const std::set<size_t>& level, size_t hops) {
+            for (size_t v : level) {
+                if (seen.insert(v).second) result.emplace(name_of(v), hops);
+            }
+        });
+        return result;
+    }
+
+    bool reachable(size_t from, size_t to, const traversal_options& options) const {
+        bool found = false;
+        walks(from, options, [&](const std::set<size_t>& level, size_t) { found = found || level.count(to); });
+        return found;
+    }
+
+    std::set<std::vector<std::string>> paths(size_t from, size_t to, const traversal_options& options) const {
+        const auto next = adjacency(options);
+        const size_t max_hops = options.max_hops == 0 ? vertices : options.max_hops;
+        std::set<std::vector<std::string>> result;
+        std::vector<size_t> path{from};
+        std::function<void()> extend = [&] {
+            if (path.size() > 1 && path.back() == to) {
+                std::vector<std::string> named;
+                for (size_t v : path) named.push_back(name_of(v));
+                result.insert(std::move(named));
+                return;
+            }
+            if (path.size() > max_hops) return;
+            for (size_t v : next[path.back()]) {
+                if (v != to && std::find(path.begin(), path.end(), v) != path.end()) continue;
+                path.push_back(v);
+                extend();
+                path.pop_back();
+            }
+        };
+        extend();
+        return result;
+    }
+
+private:
+    size_t vertices;
+    std::vector<edge> edges;
+
+    std::vector<std::set<size_t>> adjacency(const traversal_options& options) const {
+        std::vector<std::set<size_t>> next(vertices);
+        for (const auto& e : edges) {
+            bool allowed = std::all_of(options.edge_attributes.begin(), options.edge_attributes.end(), [&](const auto& a) {
+                return std::find(e.attributes.begin(), e.attributes.end(), a) != e.attributes.end();
+            });
+            if (!allowed) continue;
+            if (options.direction != traversal_direction::incoming) next[e.from].insert(e.to);
+            if (options.direction != traversal_direction::outgoing) next[e.to].insert(e.from);
+        }
+        return next;
+    }
+
+    // Calls level(reached, k) with the entities at the end of walks of exactly k edges, for k from
+    // 1 up to max_hops. Without a limit it stops once a level reaches nothing new.
+    template<typename F>
+    void walks(size_t start, const traversal_options& options, F&& level) const {
+        const auto next = adjacency(options);
+        std::set<size_t> current{start}, any;
+        for (size_t hops = 1; options.max_hops == 0 || hops <= options.max_hops; ++hops) {
+            std::set<size_t> reached;
+            for (size_t v : current) reached.insert(next[v].begin(), next[v].end());
+            level(reached, hops);
+            bool grew = false;
+            for (size_t v : reached) grew = any.insert(v).second || grew;
+            if (!grew && options.max_hops == 0) break;
+            current.swap(reached);
+        }
+    }
+};
+
+std::vector<edge> random_edges(std::mt19937& random, size_t vertices, size_t count) {
+    auto pick = [&](size_t n) { return static_cast<size_t>(random() % n); };
+    std::vector<edge> edges;
+    for (size_t i = 0; i < count; ++i) {
+        edge e{pick(vertices), pick(vertices), {}};
+        if (pick(3)) e.attributes.push_back({"kind", pick(2) ? "a" : "b"});
+        if (pick(3) == 0) e.attributes.push_back({"weight", std::to_string(pick(2))});
+        edges.push_back(std::move(e));
+    }
+    return edges;
+}
+
+void add_edges(sen::InferenceEngine& engine, std::mt19937& random, const std::vector<edge>& edges) {
+    for (const auto& e : edges) {
+        // typed facts land in their own partitions, the graph spans all of them
+        const std::string type = random() % 4 == 0 ? "app/x" : "";
+        engine.add_fact("edge", name_of(e.from), name_of(e.to), e.attributes, type);
+        if (random() % 4 == 0) engine.add_fact("other", name_of(e.to), name_of(e.from));
+    }
+}
+
+std::vector<traversal_options> all_options(const std::vector<size_t>& hops) {
+    const std::vector<std::vector<attribute_t>> filters = {
+        {}, {{"kind", "a"}}, {{"kind", "b"}}, {{"kind", "a"}, {"weight", "1"}}};
+    std::vector<traversal_options> result;
+    for (size_t max_hops : hops) {
+        for (auto direction : {traversal_direction::outgoing, traversal_direction::incoming, traversal_direction::both}) {
+            for (const auto& filter : filters) {
+                traversal_options options;
+                options.max_hops = max_hops;
+                options.direction = direction;
+                options.edge_attributes = filter;
+                result.push_back(options);
+            }
+        }
+    }
+    return result;
+}
+
+std::string describe(const traversal_options& options) {
+    static const char* directions[] = {"outgoing", "incoming", "both"};
+    std::string text = "max_hops " + std::to_string(options.max_hops) + ", " +
+                       directions[static_cast<int>(options.direction)];
+    for (const auto& attr : options.edge_attributes) text += ", " + attr.key + "=" + attr.value;
+    return text;
+}
+
+int failures = 0;
+
+void fail(const std::string& name, const std::string& what) {
+    if (++failures <= 20) std::cerr << name << ": " << what << "\n";
+}
+
+// Queries either the engine or a graph held since an earlier batch.
+struct traversals {
+    std::function<std::vector<sen::graph_hit>(const std::string&, const traversal_options&)> neighborhood;
+    std::function<bool(const std::string&, const std::string&, const traversal_options&)> reachable;
+    std::function<std::vector<std::vector<std::string>>(const std::string&, const std::string&,
+                                                        const traversal_options&)> paths;
+};
+
+traversals of(sen::InferenceEngine& engine) {
+    return {[&](const auto& entity, const auto& options) { return engine.neighborhood("edge", entity, options); },
+            [&](const auto& from, const auto& to, const auto& options) {
+                return engine.reachable("edge", from, to, options);
+            },
+            [&](const auto& from, const auto& to, const auto& options) {
+                return engine.paths("edge", from, to, options);
+            }};
+}
+
+traversals of(std::shared_ptr<const sen::relation_graph> graph) {
+    return {[=](const auto& entity, const auto& options) { return graph->neighborhood(entity, options); },
+            [=](const auto& from, const auto& to, const auto& options) { return graph->reachable(from, to, options); },
+            [=](const auto& from, const auto& to, const auto& options) { return graph->paths(from, to, options); }};
+}
+
+void check(const std::string& name, const traversals& actual, const reference_graph& expected,
+           const std::vector<size_t>& starts, const std::vector<size_t>& targets, const std::vector<size_t>& hops,
+           bool with_paths) {
+    for (const auto& options : all_options(hops)) {
+        for (size_t from : starts) {
+            const std::string query = name + ", " + describe(options) + ", from " + name_of(from);
+            const auto hits = actual.neighborhood(name_of(from), options);
+            std::set<std::pair<std::string, size_t>> found;
+            for (size_t i = 0; i < hits.size(); ++i) {
+                found.emplace(hits[i].entity, hits[i].hops);
+                if (i > 0 && hits[i].hops < hits[i - 1].hops) fail(query, "neighborhood is not breadth-first");
+            }
+            if (found.size() != hits.size() || found != expected.neighborhood(from, options)) {
+                fail(query, "neighborhood returned " + std::to_string(hits.size()) + " entities, expected " +
+                                std::to_string(expected.neighborhood(from, options).size()));
+            }
+            for (size_t to : targets) {
+                if (actual.reachable(name_of(from), name_of(to), options) != expected.reachable(from, to, options)) {
+                    fail(query + " to " + name_of(to), "reachable differs");
+                }
+                if (!with_paths) continue;
+                const auto listed = actual.paths(name_of(from), name_of(to), options);
+                const std::set<std::vector<std::string>> unique(listed.begin(), listed.end());
+                const auto reference = expected.paths(from, to, options);
+                if (unique.size() != listed.size() || unique != reference) {
+                    fail(query + " to " + name_of(to), "paths returned " + std::to_string(listed.size()) +
+                                                           ", expected " + std::to_string(reference.size()));
+                }
+            }
+        }
+        if (!actual.neighborhood("missing", options).empty() || actual.reachable("missing", "missing", options) ||
+            !actual.paths(name_of(0), "missing", options).empty()) {
+            fail(name + ", " + describe(options), "unknown entity was found");
+        }
+    }
+}
+
+// Small graphs in three batches, every traversal between every pair of entities.
+void small_graph(unsigned seed, const variant& v) {
+    std::mt19937 random(seed);
+    const size_t vertices = 7;
+    sen::InferenceEngine engine(v.rules, *v.storage);
+    engine.set_partitions(v.partitions);
+    std::vector<size_t> all(vertices);
+    for (size_t i = 0; i < vertices; ++i) all[i] = i;
+
+    std::vector<edge> edges;
+    std::shared_ptr<const sen::relation_graph> first;
+    std::vector<edge> first_edges;
+    for (int batch = 0; batch < 3; ++batch) {
+        auto added = random_edges(random, vertices, 3 + random() % 4);
+        add_edges(engine, random, added);
+        edges.insert(edges.end(), added.begin(), added.end());
+        const std::string name = "Seed " + std::to_string(seed) + ", " + v.name + ", batch " + std::to_string(batch);
+        check(name, of(engine), reference_graph(vertices, edges), all, all, {0, 1, 2, 3}, true);
+        // a flush finishing in between publishes a new version, so only current graphs are reused
+        const auto latest = engine.graph("edge");
+        if (engine.graph("edge") != latest && !latest->stale(*engine.snapshot())) {
+            fail(name, "graph of an unchanged snapshot was rebuilt");
+        }
+        if (batch == 0) {
+            first = latest;
+            first_edges = edges;
+        } else if (!first->stale(*engine.snapshot()) || engine.graph("edge")->version() <= first->version()) {
+            fail(name, "graph of batch 0 is not stale");
+        }
+    }
+    check("Seed " + std::to_string(seed) + ", " + v.name + ", graph of batch 0", of(first),
+          reference_graph(vertices, first_edges), all, all, {0, 1, 2, 3}, true);
+}
+
+// Without a hop limit the frontiers of a large graph are split over the workers.
+void large_graph(unsigned seed, const variant& v) {
+    std::mt19937 random(seed);
+    const size_t vertices = 3000;
+    sen::InferenceEngine engine(v.rules, *v.storage);
+    engine.set_partitions(v.partitions);
+    std::vector<size_t> starts = {0, 1};
+    std::vector<edge> edges;
+    for (int batch = 0; batch < 2; ++batch) {
+        auto added = random_edges(random, vertices, 4500);
+        add_edges(engine, random, added);
+        edges.insert(edges.end(), added.begin(), added.end());
+        const std::string name = "Large seed " + std::to_string(seed) + ", " + v.name + ", batch " +
+                                 std::to_string(batch);
+        check(name, of(engine), reference_graph(vertices, edges), starts, {0, 1, 2}, {0, 3}, false);
+    }
+}
+} // namespace
+
+int main() {
+    sen::fact_store_options spill;
+    spill.buffer_facts = 4;
+    spill.max_buffered_facts = 16;
+    spill.max_merge_facts = 256;
+    sen_test::environment env("graph", spill);
+    const auto no_rules = std::make_shared<const sen::rule_set>();
+    const std::vector<variant> strategies = {{"sequential", no_rules, 1, nullptr},
+                                             {"4 partitions", no_rules, 4, nullptr}};
+    for (const auto& v : env.variants(strategies)) {
+        for (unsigned seed = 1; seed <= 10; ++seed) small_graph(seed, v);
+        if (v.partitions > 1) large_graph(1, v);
+    }
+    return env.report(failures, "All traversals matched the brute force",
+                      std::to_string(failures) + " traversals differ");
+}
@@ -0,0 +1,81 @@
+// rule_scheduling.cpp
+// Checks how often the engine evaluates each rule, which comparing derived relations cannot
+// tell from naive re-evaluation of every rule in every round. The rules of scheduling.sen form a
+// recursive stratum that derives p(n0, n2) to p(n0, n10) one per round along a chain of edges,
+// with q_from_p and p_from_q closing the cycle through q, and a non-recursive stratum reading p:
+//  - p_step runs in all 10 rounds of its stratum, the last one reaching the fixpoint,
+//  - p_from_q only runs in rounds 1 and 2, q changes in round 1 only,
+//  - far runs exactly once.
+#include <iostream>
+#include <map>
+#include <sstream>
+#include "test_support.h"
+
+namespace {
+using sen_test::variant;
+
+// Evaluations per rule name, counted from the engine log; interpreted copies count as the rule.
+std::map<std::string, int> evaluations(const std::string& log) {
+    static const std::string marker = "    Applying rule: ";
+    static const std::string suffix = "_interpreted";
+    std::map<std::string, int> count;
+    std::istringstream lines(log);
+    for (std::string line; std::getline(lines, line);) {
+        if (line.compare(0, marker.size(), marker) != 0) continue;
+        std::string name = line.substr(marker.size(), line.find(' ', marker.size()) - marker.size());
+        if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            name.erase(name.size() - suffix.size());
+        }
+        count[name]++;
+    }
+    return count;
+}
+
+int check(const variant& v) {
+    sen::InferenceEngine engine(v.rules, *v.storage);
+    engine.set_partitions(v.partitions);
+    engine.add_fact("p", "n0", "n1");
+    for (int i = 0; i < 10; ++i) engine.add_fact("edge", "n" + std::to_string(i), "n" + std::to_string(i + 1));
+    engine.add_fact("short", "n1", "z");
+    engine.add_fact("back", "z", "n1");
+
+    std::stringstream log;
+    auto* muted = std::cout.rdbuf(log.rdbuf());
+    const auto result = engine.infer("app/chain", 2, 0, sen::infer_limits{});
+    std::cout.rdbuf(muted);
+
+    int failures = 0;
+    auto count = evaluations(log.str());
+    for (const auto& [rule, expected] : std::map<std::string, int>{{"p_step", 10}, {"q_from_p", 10},
+                                                                   {"p_from_q", 2}, {"far", 1}}) {
+        if (count[rule] == expected) continue;
+        failures++;
+        std::cerr << v.name << ": " << rule << " evaluated " << count[rule] << " times, expected " << expected
+                  << "\n";
+    }
+    if (result.status != sen::infer_status::complete || result.relations.size() != 9 + 1 + 9) {
+        failures++;
+        std::cerr << v.name << ": derived " << result.relations.size() << " relations with status "
+                  << sen::to_string(result.status) << ", expected 19\n";
+    }
+    return failures;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: sen-scheduling-test <rules.sen>\n";
+        return 2;
+    }
+    sen::fact_store_options spill;
+    spill.buffer_facts = 4;
+    spill.max_buffered_facts = 16;
+    spill.max_merge_facts = 64;
+    sen_test::environment env("scheduling", spill);
+    int failures = 0;
+    for (const auto& v : env.variants(sen_test::strategies(sen_test::parse_file(argv[1]), {4}))) {
+        failures += check(v);
+    }
+    return env.report(failures, "All rules were evaluated as scheduled",
+                      "Rules were evaluated too often or too rarely");
+}
@@ -0,0 +1,109 @@
+// test_support.h
+// Harness shared by the engine tests: a muted engine log, a spill directory for the out-of-core
+// variants and the evaluation strategies every check runs with.
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "inference_engine.h"
+
+namespace sen_test {
+// One way of running the engine: a rule set, the number of join workers and the fact storage.
+struct variant {
+    std::string name;
+    std::shared_ptr<const sen::rule_set> rules;
+    size_t partitions;
+    const sen::fact_store_options* storage;
+};
+
+// The engine logs every step, only failures are reported: standard output is muted while the
+// environment exists. out_of_core spills to a fresh directory that is removed again afterwards.
+class environment {
+public:
+    // spill sets the buffer and merge sizes of out_of_core, its directory is created here.
+    environment(const std::string& name, sen::fact_store_options spill)
+        : out_of_core(std::move(spill)), log(std::cout.rdbuf(nullptr)) {
+        std::string pattern = "/tmp/sen-" + name + "-XXXXXX";
+        if (!::mkdtemp(pattern.data())) {
+            std::cout.rdbuf(log);
+            throw std::runtime_error("Cannot create a segment directory");
+        }
+        out_of_core.directory = pattern;
+    }
+    ~environment() {
+        ::rmdir(out_of_core.directory.c_str());
+        std::cout.rdbuf(log);
+    }
+    environment(const environment&) = delete;
+    environment& operator=(const environment&) = delete;
+
+    // Every strategy in memory and out of core.
+    std::vector<variant> variants(const std::vector<variant>& strategies) const {
+        std::vector<variant> result;
+        for (const auto* storage : {&in_memory, &out_of_core}) {
+            for (const auto& v : strategies) {
+                result.push_back({v.name + (storage == &in_memory ? ", in memory" : ", out of core"), v.rules,
+                                  v.partitions, storage});
+            }
+        }
+        return result;
+    }
+
+    // Restores standard output to print the outcome, returns the exit code.
+    int report(int failures, const std::string& passed, const std::string& failed) {
+        std::cout.rdbuf(log);
+        std::cout << (failures == 0 ? passed : failed) << "\n";
+        return failures == 0 ? 0 : 1;
+    }
+
+    const sen::fact_store_options in_memory;
+    sen::fact_store_options out_of_core;
+
+private:
+    std::streambuf* log;
+};
+
+inline std::shared_ptr<const sen::rule_set> parse_file(const std::string& path) {
+    std::ifstream in(path);
+    std::stringstream dsl;
+    dsl << in.rdbuf();
+    return sen::rule_set::parse(dsl.str());
+}
+
+// Renamed rules have no compiled counterpart, so they always run in the interpreter.
+inline std::shared_ptr<const sen::rule_set> interpreted(const sen::rule_set& rules) {
+    auto contexts = rules.contexts();
+    for (auto& ctx : contexts) {
+        for (auto& rule : ctx.rules) rule.name += "_interpreted";
+    }
+    return std::make_shared<const sen::rule_set>(rules.aliases(), std::move(contexts));
+}
+
+inline bool all_compiled(const sen::rule_set& rules, bool compiled) {
+    for (const auto& stratum : rules.strata()) {
+        for (const auto& node : stratum.rules) {
+            if ((node.compiled != nullptr) != compiled) return false;
+        }
+    }
+    return true;
+}
+
+// The interpreter, the compiled rules and the partitioned join on each of the given worker
+// counts. Fails if sen-rulegen's code for the rules is not linked in.
+inline std::vector<variant> strategies(const std::shared_ptr<const sen::rule_set>& compiled,
+                                       const std::vector<size_t>& partitions) {
+    auto interpreter = interpreted(*compiled);
+    if (!all_compiled(*compiled, true) || !all_compiled(*interpreter, false)) {
+        throw std::runtime_error("Compiled rules are not linked in");
+    }
+    std::vector<variant> result = {{"interpreter", interpreter, 1, nullptr}, {"compiled", compiled, 1, nullptr}};
+    for (size_t count : partitions) result.push_back({std::to_string(count) + " partitions", compiled, count, nullptr});
+    return result;
+}
+} // namespace sen_test